@@ -0,0 +1,189 @@
+// Measures the driver's own overhead on a synthetic project.
+//
+//   c++ -std=c++17 -O2 -pthread -o driver bench/driver.cc
+//   ./driver [sources=10000] [headers=400] [depth=8] [fanin=4] [-j N] > /dev/null
+//
+// Sources are spread over directories of 100 and each includes `fanin`
+// headers. Every header pulls in the next one in its chain of `depth`. The
+// compiler is this binary again: it scans the includes, writes a depfile and
+// an empty object, so the timings are dominated by spawning and the driver.
+
+#include "../build.hh"
+
+#include <chrono>
+#include <fstream>
+#include <sys/resource.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+long peak_rss_mb()
+{
+	rusage usage{};
+	::getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss >> 10;
+}
+
+void write(const std::filesystem::path& path, const std::string& text)
+{
+	std::filesystem::create_directories(path.parent_path());
+	std::ofstream(path) << text;
+}
+
+// Enough of a compiler to leave behind what a real one would.
+int stub(int argc, char** argv)
+{
+	std::string source, output, depfile;
+	std::vector<std::filesystem::path> search;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-c" && i + 1 < argc) source = argv[++i];
+		else if (arg == "-o" && i + 1 < argc) output = argv[++i];
+		else if (arg == "-MF" && i + 1 < argc) depfile = argv[++i];
+		else if (arg.rfind("-I", 0) == 0) search.emplace_back(arg.substr(2));
+	}
+	if (output.empty()) return 1;
+	std::ofstream(output).flush();
+	if (source.empty() || depfile.empty()) return 0;
+
+	std::vector<std::string> seen{source};
+	for (size_t i = 0; i < seen.size(); ++i) {
+		std::ifstream file(seen[i]);
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.rfind("#include \"", 0) != 0) continue;
+			auto name = line.substr(10, line.size() - 11);
+			for (const auto& directory : search) {
+				auto path = (directory / name).string();
+				if (!std::filesystem::exists(path)) continue;
+				if (std::find(seen.begin(), seen.end(), path) == seen.end()) seen.push_back(path);
+				break;
+			}
+		}
+	}
+
+	std::string deps = output + ":";
+	for (const auto& path : seen)
+		deps += " \\\n " + path;
+	std::ofstream(depfile) << deps << "\n";
+	return 0;
+}
+
+Kitchen::Ingredients generate(size_t sources, size_t headers, size_t depth, size_t fanin)
+{
+	for (size_t i = 0; i < headers; ++i) {
+		std::string text = "#pragma once\n";
+		if ((i + 1) % depth != 0 && i + 1 < headers) text += "#include \"h" + std::to_string(i + 1) + ".h\"\n";
+		write("include/h" + std::to_string(i) + ".h", text);
+	}
+
+	Kitchen::Ingredients files;
+	for (size_t i = 0; i < sources; ++i) {
+		std::string text;
+		for (size_t k = 0; k < fanin; ++k)
+			text += "#include \"h" + std::to_string((i * 7 + k * 31) % headers) + ".h\"\n";
+		text += "int f" + std::to_string(i) + "() { return 0; }\n";
+
+		auto path = "src/d" + std::to_string(i / 100) + "/s" + std::to_string(i) + ".cc";
+		write(path, text);
+		files += path;
+	}
+	return files;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i)
+		if (std::string(argv[i]) == "--stub") return stub(argc, argv);
+
+	std::vector<size_t> positional;
+	size_t workers = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-j" && i + 1 < argc) workers = std::stoul(argv[++i]);
+		else if (arg.rfind("-j", 0) == 0) workers = std::stoul(arg.substr(2));
+		else positional.push_back(std::stoul(arg));
+	}
+	auto parameter = [&](size_t index, size_t fallback) {
+		return index < positional.size() ? std::max<size_t>(positional[index], 1) : fallback;
+	};
+	size_t sources = parameter(0, 10000), headers = parameter(1, 400);
+	size_t depth = parameter(2, 8), fanin = parameter(3, 4);
+
+	std::string self = std::filesystem::canonical("/proc/self/exe").string();
+	auto root = std::filesystem::temp_directory_path() / "flavortown-driver-bench";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root);
+	std::filesystem::current_path(root);
+
+	auto start = Clock::now();
+	auto files = generate(sources, headers, depth, fanin);
+	std::cerr << "generated " << sources << " sources and " << headers << " headers in " << since(start) << " s\n";
+
+	Kitchen::CompilerRecipe recipe("bench");
+	recipe.compiler(self).push({"--stub", "-Iinclude"}).files(files).output("app").objects("obj").cache();
+
+	// The cost of one spawn with nothing scheduled around it.
+	const size_t samples = 50;
+	start = Clock::now();
+	for (size_t i = 0; i < samples; ++i)
+		Kitchen::Sink::start_job_sync({self, "--stub", "-o", "obj/probe"}, true);
+	double spawn = since(start) / samples;
+
+	auto build = [&](const char* name) {
+		Kitchen::LineCook cook;
+		cook.args(argc, argv);
+		cook += &recipe;
+		auto began = Clock::now();
+		int status = cook.cook();
+		double wall = since(began);
+		std::cerr << name << ": status " << status << ", wall " << wall << " s\n";
+		return wall;
+	};
+
+	double full = build("full build");
+	size_t jobs = sources + 1;
+	double ideal = jobs * spawn / std::max<size_t>(workers, 1);
+	std::cerr << "  spawn " << spawn * 1e6 << " us/job, scheduling overhead ~"
+			  << std::max(full - ideal, 0.0) * 1e6 / jobs << " us/job over " << jobs << " jobs at -j" << workers
+			  << "\n";
+
+	build("no-op build");
+
+	const size_t rounds = 20;
+	start = Clock::now();
+	size_t total = 0;
+	for (size_t i = 0; i < rounds; ++i)
+		total += files.get_ingredients().size();
+	std::cerr << "get_ingredients: " << since(start) / rounds * 1e3 << " ms per call (" << total / rounds
+			  << " files)\n";
+
+	// The first walk reads every directory and files away the listings; the
+	// second only stats the directories.
+	for (const char* name : {"glob (listings cold)", "glob (listings warm)"}) {
+		start = Clock::now();
+		size_t found = Kitchen::Ingredients().glob("src/**/*.cc").get_ingredients().size();
+		std::cerr << name << ": " << since(start) * 1e3 << " ms (" << found << " files)\n";
+	}
+
+	auto objects = recipe.prep();
+	start = Clock::now();
+	size_t stale = 0;
+	for (auto* object : objects)
+		stale += object->rebuild_needed();
+	stale += recipe.rebuild_needed();
+	std::cerr << "rebuild_needed: " << since(start) * 1e3 << " ms over " << objects.size() + 1 << " recipes, "
+			  << stale << " stale\n";
+
+	std::cerr << "peak rss: " << peak_rss_mb() << " MiB\n";
+	std::filesystem::current_path("/");
+	std::filesystem::remove_all(root);
+}
@@ -0,0 +1,131 @@
+// Compares LineCook's bounded pool against the old thread-per-recipe loop.
+//
+//   c++ -std=c++17 -O2 -pthread -o line_cook bench/line_cook.cc
+//   ./line_cook [recipes=200] [megabytes=64] [milliseconds=200] [-j N]
+//
+// Every recipe re-invokes this binary as a job that touches `megabytes` of
+// memory for `milliseconds`. Peak RSS is sampled across the whole process tree.
+
+#include "../build.hh"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+struct Job : Kitchen::Recipe
+{
+	std::vector<std::string> m_Command;
+
+	std::vector<std::string> get_command() const override
+	{
+		return m_Command;
+	}
+
+	bool rebuild_needed() const override
+	{
+		return true;
+	}
+};
+
+int run_job(size_t megabytes, size_t milliseconds)
+{
+	std::vector<char> memory(megabytes << 20);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+	for (char value = 0; std::chrono::steady_clock::now() < deadline; ++value)
+		std::memset(memory.data(), value, memory.size());
+	return 0;
+}
+
+size_t rss_kb(const std::string& pid)
+{
+	std::ifstream status("/proc/" + pid + "/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.rfind("VmRSS:", 0) == 0) return std::stoul(line.substr(6));
+	return 0;
+}
+
+size_t tree_rss_kb(const std::string& pid)
+{
+	size_t total = rss_kb(pid);
+	std::error_code ec;
+	for (const auto& task : std::filesystem::directory_iterator("/proc/" + pid + "/task", ec)) {
+		std::ifstream children(task.path() / "children");
+		std::string child;
+		while (children >> child)
+			total += tree_rss_kb(child);
+	}
+	return total;
+}
+
+template<typename F>
+void measure(const char* name, F&& body)
+{
+	std::atomic<bool> done(false);
+	size_t peak = 0;
+	std::thread sampler([&]() {
+		while (!done.load()) {
+			peak = std::max(peak, tree_rss_kb("self"));
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	int status = body();
+	auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	done.store(true);
+	sampler.join();
+
+	std::cerr << name << ": status " << status << ", wall " << wall << " s, peak rss " << (peak >> 10) << " MiB\n";
+}
+
+int thread_per_recipe(const std::vector<Job>& recipes)
+{
+	std::vector<std::thread> threads;
+	std::atomic<int> error(0);
+	for (const auto& recipe : recipes) {
+		auto command = recipe.get_command();
+		threads.push_back(std::thread([command, &error]() {
+			if (error.load() != 0) return;
+			int status = Kitchen::Sink::start_job_sync(command);
+			if (status != 0) error.store(status);
+		}));
+	}
+	for (auto& thread : threads)
+		thread.join();
+	return error.load();
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc == 4 && std::string(argv[1]) == "--job") return run_job(std::stoul(argv[2]), std::stoul(argv[3]));
+
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-j") ++i;
+		else if (arg.rfind("-j", 0) != 0) positional.push_back(arg);
+	}
+
+	size_t count = positional.size() > 0 ? std::stoul(positional[0]) : 200;
+	std::string megabytes = positional.size() > 1 ? positional[1] : "64";
+	std::string milliseconds = positional.size() > 2 ? positional[2] : "200";
+
+	std::string self = std::filesystem::canonical("/proc/self/exe").string();
+	std::vector<Job> recipes(count);
+	for (auto& recipe : recipes)
+		recipe.m_Command = {self, "--job", megabytes, milliseconds};
+
+	measure("thread-per-recipe", [&]() { return thread_per_recipe(recipes); });
+	measure("line-cook", [&]() {
+		Kitchen::LineCook cook;
+		cook.args(argc, argv);
+		for (auto& recipe : recipes)
+			cook += &recipe;
+		return cook.cook();
+	});
+}
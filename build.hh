@@ -1,20 +1,53 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstdarg>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <cstdlib>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
+#include <poll.h>
+#include <spawn.h>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <thread>
+#include <tuple>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif // __linux__
+
 #ifndef CC
 #define CC "clang++"
 #endif
@@ -26,63 +59,12 @@
 	} while (0)
 #else
 #ifdef GUY_FIERI
-#define GO_REBUILD_YOURSELF(argc, argv)                                                                                \
-	do {                                                                                                               \
-		std::filesystem::path source_file = std::filesystem::path(__FILE__);                                           \
-		std::string executable_name = Kitchen::Sink::get_executable_name(source_file.filename().string());             \
-		std::filesystem::path executable = std::filesystem::path(executable_name);                                     \
-                                                                                                                       \
-		if (!std::filesystem::exists(executable)                                                                       \
-			|| std::filesystem::last_write_time(source_file) > std::filesystem::last_write_time(executable)) {         \
-			Kitchen::Sink::stage(0);                                                                                   \
-			std::cout << "[INFO] Rebuilding " << executable << "...\n";                                                \
-			std::vector<std::string> command                                                                           \
-				= {CC, "-DGUY_FIERI", "-DDUMB_MESSAGES", "-Oz", "-o", executable_name, __FILE__};                      \
-			std::string cmd_str = std::string(CC) + " -DGUY_FIERI -DDUMB_MESSAGES -Oz -o " + executable_name + " "     \
-								+ std::string(__FILE__);                                                               \
-			int status = std::system(cmd_str.c_str());                                                                 \
-			if (status != 0) {                                                                                         \
-				std::cout << "[ERROR] Rebuilding " << executable << " has failed, aborting...\n";                      \
-				std::exit(status);                                                                                     \
-			}                                                                                                          \
-                                                                                                                       \
-			std::vector<const char*> new_argv(argc);                                                                   \
-			new_argv[0] = ("./" + executable_name).c_str();                                                            \
-			for (int i = 1; i < argc; ++i) {                                                                           \
-				new_argv[i] = argv[i];                                                                                 \
-			}                                                                                                          \
-			new_argv.push_back(nullptr);                                                                               \
-			std::cout << "[INFO] Rebuild, restarting...\n";                                                            \
-			execv(("./" + executable_name).c_str(), const_cast<char* const*>(new_argv.data()));                        \
-		}                                                                                                              \
-	} while (0)
+#define GO_REBUILD_YOURSELF(argc, argv) Kitchen::Sink::rebuild_yourself(argc, argv, __FILE__, false)
 #else
 #define GO_REBUILD_YOURSELF(argc, argv)                                                                                \
 	do {                                                                                                               \
-		std::filesystem::path source_file = std::filesystem::path(__FILE__);                                           \
-		std::string executable_name = Kitchen::Sink::get_executable_name(source_file.filename().string());             \
-		std::filesystem::path executable = std::filesystem::path(executable_name);                                     \
-                                                                                                                       \
-		Kitchen::Sink::stage(0);                                                                                       \
-		std::cout << "[INFO] Rebuilding " << executable << " with optimizations...\n";                                 \
 		MESSAGES();                                                                                                    \
-		std::vector<std::string> command                                                                               \
-			= {CC, "-DGUY_FIERI", "-DDUMB_MESSAGES", "-Oz", "-o", executable_name, __FILE__};                          \
-		std::string cmd_str = std::string(CC) + " -DGUY_FIERI -DDUMB_MESSAGES -Oz -o " + executable_name + " "         \
-							+ std::string(__FILE__);                                                                   \
-		int status = std::system(cmd_str.c_str());                                                                     \
-		if (status != 0) {                                                                                             \
-			std::cout << "[ERROR] Rebuilding " << executable << " has failed, aborting...\n";                          \
-			std::exit(status);                                                                                         \
-		}                                                                                                              \
-		std::vector<const char*> new_argv(argc);                                                                       \
-		new_argv[0] = ("./" + executable_name).c_str();                                                                \
-		for (int i = 1; i < argc; ++i) {                                                                               \
-			new_argv[i] = argv[i];                                                                                     \
-		}                                                                                                              \
-		new_argv.push_back(nullptr);                                                                                   \
-		std::cout << "[INFO] Optimized, restarting...\n";                                                              \
-		execv(("./" + executable_name).c_str(), const_cast<char* const*>(new_argv.data()));                            \
+		Kitchen::Sink::rebuild_yourself(argc, argv, __FILE__, true);                                                   \
 	} while (0)
 #endif // GUY_FIERI
 #endif // _WIN32
@@ -125,6 +107,8 @@
 #define WARN(msg) Kitchen::Sink::log(Kitchen::Sink::LogLevel::WARN, msg)
 #define ERROR(msg) Kitchen::Sink::log(Kitchen::Sink::LogLevel::ERROR, msg)
 
+extern char** environ;
+
 namespace Kitchen {
 namespace Sink {
 
@@ -143,22 +127,260 @@ inline void log(LogLevel level, const std::string_view& message)
 	std::cout << ss.str();
 }
 
-inline int start_job_sync(const std::vector<std::string>& command)
+struct JobResult
+{
+	int m_Status = 0;
+	std::string m_Output;
+	std::string m_Errors;
+	uint64_t m_PeakRss = 0;
+};
+
+// Process groups of the jobs in flight. A captured job runs in a group of its
+// own so it can be taken down along with anything it spawned. A live job
+// stays in ours so it can still read the terminal, and is kept as its negated
+// pid. The slots are lock-free because the signal handler forwards an
+// interrupt through them: jobs outside our group no longer see the terminal's
+// Ctrl+C themselves.
+class Burners
 {
-	int result = std::system(
-		std::accumulate(std::next(command.begin()), command.end(), command[0], [](std::string a, std::string b) {
-			return a + " " + b;
-		}).c_str());
+  private:
+	static constexpr size_t SLOTS = 1024;
+	std::atomic<pid_t> m_Groups[SLOTS] = {};
+	std::atomic<bool> m_Cancelled{false};
+
+	Burners();
+	static void forward(int signal);
+	static void send(pid_t id, int signal);
+
+  public:
+	void light(pid_t group);
+	void douse(pid_t group);
+	void cancel(std::chrono::milliseconds grace = std::chrono::seconds(2));
+	void reset();
+	bool cancelled() const;
 
-#ifndef _WIN32
-	if (WIFEXITED(result)) {
-		int exit_status = WEXITSTATUS(result);
-		return exit_status;
+	static Burners& shared();
+};
+
+inline Burners::Burners()
+{
+	for (int signal : {SIGINT, SIGTERM, SIGHUP}) {
+		struct sigaction current;
+		if (::sigaction(signal, nullptr, &current) != 0 || current.sa_handler != SIG_DFL) continue;
+		struct sigaction handler = {};
+		handler.sa_handler = &Burners::forward;
+		sigemptyset(&handler.sa_mask);
+		::sigaction(signal, &handler, nullptr);
 	}
-#endif // _WIN32
+}
+
+// Live jobs already got an interrupt from the terminal along with us.
+inline void Burners::forward(int signal)
+{
+	for (auto& group : shared().m_Groups) {
+		pid_t id = group.load();
+		if (id > 0 || (id < 0 && signal != SIGINT)) send(id, signal);
+	}
+	::signal(signal, SIG_DFL);
+	::raise(signal);
+}
+
+inline void Burners::send(pid_t id, int signal)
+{
+	if (id > 0) ::killpg(id, signal);
+	else if (id < 0) ::kill(-id, signal);
+}
+
+inline void Burners::light(pid_t group)
+{
+	for (auto& slot : m_Groups) {
+		pid_t empty = 0;
+		if (slot.compare_exchange_strong(empty, group)) break;
+	}
+	if (m_Cancelled) send(group, SIGTERM);
+}
+
+inline void Burners::douse(pid_t group)
+{
+	for (auto& slot : m_Groups) {
+		pid_t expected = group;
+		if (slot.compare_exchange_strong(expected, 0)) break;
+	}
+}
+
+// Asks every job in flight to stop, and insists once `grace` has passed.
+// Jobs lit after this are stopped straight away until reset().
+inline void Burners::cancel(std::chrono::milliseconds grace)
+{
+	m_Cancelled = true;
+	for (auto& group : m_Groups)
+		send(group.load(), SIGTERM);
+
+	auto deadline = std::chrono::steady_clock::now() + grace;
+	auto burning = [this]() {
+		return std::any_of(std::begin(m_Groups), std::end(m_Groups), [](const auto& group) { return group != 0; });
+	};
+	while (burning() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	for (auto& group : m_Groups)
+		send(group.load(), SIGKILL);
+}
+
+inline void Burners::reset()
+{
+	m_Cancelled = false;
+}
+
+inline bool Burners::cancelled() const
+{
+	return m_Cancelled;
+}
+
+inline Burners& Burners::shared()
+{
+	static Burners burners;
+	return burners;
+}
+
+// A pipe whose ends are not inherited by jobs. macOS has no pipe2, so there
+// the flag is set afterwards and jobs are spawned with
+// POSIX_SPAWN_CLOEXEC_DEFAULT, which covers the moment in between.
+inline bool open_pipe(int fds[2])
+{
+#ifdef __APPLE__
+	if (::pipe(fds) != 0) return false;
+	::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return true;
+#else
+	return ::pipe2(fds, O_CLOEXEC) == 0;
+#endif
+}
+
+// Spawns `command` directly, without a shell. With `capture` the job's stdout
+// and stderr are collected instead of going straight to the terminal, and it
+// runs in a process group of its own. A live job stays in the foreground
+// group with us, since reading the terminal from a background group stops it.
+inline JobResult start_job_sync(const std::vector<std::string>& command, bool capture)
+{
+	JobResult result;
+	std::vector<char*> argv;
+	for (const auto& argument : command)
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	argv.push_back(nullptr);
+
+	int out[2] = {-1, -1};
+	int err[2] = {-1, -1};
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (capture) {
+		if (!open_pipe(out) || !open_pipe(err)) {
+			for (int fd : {out[0], out[1], err[0], err[1]})
+				if (fd >= 0) ::close(fd);
+			posix_spawn_file_actions_destroy(&actions);
+			result.m_Status = 127;
+			result.m_Errors = "could not create pipes: " + std::string(std::strerror(errno)) + "\n";
+			return result;
+		}
+		posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+	}
+
+	auto& burners = Burners::shared();
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	short flags = capture ? POSIX_SPAWN_SETPGROUP : 0;
+#ifdef __APPLE__
+	flags |= POSIX_SPAWN_CLOEXEC_DEFAULT;
+	posix_spawn_file_actions_addinherit_np(&actions, STDIN_FILENO);
+	if (!capture) posix_spawn_file_actions_addinherit_np(&actions, STDOUT_FILENO);
+	if (!capture) posix_spawn_file_actions_addinherit_np(&actions, STDERR_FILENO);
+#endif
+	posix_spawnattr_setflags(&attributes, flags);
+	if (capture) posix_spawnattr_setpgroup(&attributes, 0);
+
+	pid_t pid;
+	int spawned = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), environ);
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&actions);
+	pid_t burner = capture ? pid : -pid;
+	if (spawned == 0) burners.light(burner);
+	if (capture) {
+		::close(out[1]);
+		::close(err[1]);
+	}
+
+	if (spawned != 0) {
+		if (capture) {
+			::close(out[0]);
+			::close(err[0]);
+		}
+		result.m_Status = 127;
+		result.m_Errors = command[0] + ": " + std::strerror(spawned) + "\n";
+		if (!capture) std::cerr << result.m_Errors;
+		return result;
+	}
+
+	if (capture) {
+		pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+		std::string* sinks[2] = {&result.m_Output, &result.m_Errors};
+		char buffer[1 << 14];
+		int open = 2;
+		while (open > 0) {
+			if (::poll(fds, 2, -1) < 0) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			for (int i = 0; i < 2; ++i) {
+				if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+				ssize_t read = ::read(fds[i].fd, buffer, sizeof(buffer));
+				if (read > 0) {
+					sinks[i]->append(buffer, read);
+				} else if (read == 0 || errno != EINTR) {
+					::close(fds[i].fd);
+					fds[i].fd = -1;
+					--open;
+				}
+			}
+		}
+		for (const auto& fd : fds)
+			if (fd.fd >= 0) ::close(fd.fd);
+	}
+
+	// The job's peak also covers the children it waited for, such as cc1plus.
+	int status = 0;
+	rusage usage = {};
+	while (::wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+	burners.douse(burner);
+#ifdef __APPLE__
+	result.m_PeakRss = uint64_t(usage.ru_maxrss);
+#else
+	result.m_PeakRss = uint64_t(usage.ru_maxrss) << 10;
+#endif
+	if (WIFEXITED(status))
+		result.m_Status = WEXITSTATUS(status);
+	else if (WIFSIGNALED(status))
+		result.m_Status = 128 + WTERMSIG(status);
 	return result;
 }
 
+inline int start_job_sync(const std::vector<std::string>& command)
+{
+	return start_job_sync(command, false).m_Status;
+}
+
+// Writes a finished job's captured output as one uninterrupted block.
+inline void print_job_output(const JobResult& result)
+{
+	static std::mutex lock;
+	if (result.m_Output.empty() && result.m_Errors.empty()) return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::cout << result.m_Output << std::flush;
+	std::cerr << result.m_Errors << std::flush;
+}
+
 inline char* shift_args(int* argc, char*** argv)
 {
 	return (*argc)--, *(*argv)++;
@@ -186,236 +408,3660 @@ inline std::string get_executable_name(const std::string& source_file)
 	return executable_name;
 }
 
-inline void stage(int stage)
+// 64-bit FNV-1a; pass the previous result as `seed` to chain several pieces.
+inline uint64_t hash(std::string_view data, uint64_t seed = 14695981039346656037ull)
 {
-	std::stringstream ss;
-	ss << "====== STAGE ";
-	ss << stage;
-	ss << " ======";
-	Kitchen::Sink::log(Kitchen::Sink::LogLevel::INFO, ss.str());
+	for (unsigned char c : data)
+		seed = (seed ^ c) * 1099511628211ull;
+	return seed;
 }
 
-} // namespace Sink
-
-enum class Heat;
+inline uint64_t hash_command(const std::vector<std::string>& command)
+{
+	uint64_t result = hash({});
+	for (const auto& argument : command)
+		result = hash(std::string_view(argument.c_str(), argument.size() + 1), result);
+	return result;
+}
 
-class Recipe
+struct Stamp
 {
-  public:
-	virtual ~Recipe(){};
-	virtual std::vector<std::string> get_command() const = 0;
-	virtual bool rebuild_needed() const = 0;
+	bool m_Exists = false;
+	int64_t m_Mtime = 0;
+	int64_t m_Size = 0;
 };
 
-class Ingredients;
-
-class Ingredients
+inline Stamp stamp_of(const struct stat& info)
 {
-  private:
-	std::vector<std::string> m_Files;
-	std::string m_Prefix;
-
-  public:
-	Ingredients() = default;
-	Ingredients(Ingredients&& rhs) = default;
-	Ingredients(const Ingredients& rhs) = default;
-	Ingredients& operator=(const Ingredients& rhs) = default;
-	Ingredients& prefix(const std::string& prefix);
-	Ingredients& add_ingredients(const std::string& file);
-	void operator+=(const std::string& file);
+#ifdef __APPLE__
+	const auto& mtime = info.st_mtimespec;
+#else
+	const auto& mtime = info.st_mtim;
+#endif
+	return {true, int64_t(mtime.tv_sec) * 1000000000 + mtime.tv_nsec, int64_t(info.st_size)};
+}
 
-	std::vector<std::string> get_ingredients() const;
-};
+inline Stamp stamp(const std::string& path)
+{
+	struct stat info;
+	if (::stat(path.c_str(), &info) != 0) return {};
+	return stamp_of(info);
+}
 
-class CompilerRecipe : public Recipe
+// Stamps of every path this process has looked at. Each path is interned once
+// and stat'ed once until it is forgotten, which the driver does for everything
+// a job writes and everything the watcher reports.
+class StatCache
 {
   private:
-	bool m_Cache;
-	std::filesystem::path m_Output;
-	std::optional<Ingredients> m_Files;
-	std::vector<std::string> m_Command;
+	struct Entry
+	{
+		Stamp m_Stamp;
+		bool m_Known = false;
+	};
 
-  public:
-	CompilerRecipe() = default;
-	CompilerRecipe(std::string name) : m_Cache(false), m_Output(), m_Files(std::nullopt){};
+	struct Shard
+	{
+		std::mutex m_Lock;
+		std::deque<std::string> m_Paths;
+		std::unordered_map<std::string_view, Entry> m_Entries;
+	};
 
-	CompilerRecipe(const CompilerRecipe& rhs) = default;
-	CompilerRecipe(CompilerRecipe&& rhs) = default;
+	static constexpr size_t SHARDS = 64;
+	Shard m_Shards[SHARDS];
 
-	CompilerRecipe& files(const Ingredients& files);
-	CompilerRecipe& output(const std::string& name);
-	CompilerRecipe& compiler(const std::string& compiler);
-	CompilerRecipe& std_version(const std::string& version);
-	CompilerRecipe& cache();
-	CompilerRecipe& cache(bool cache);
-	CompilerRecipe& push(const std::vector<std::string>& flags);
-	CompilerRecipe& optimization(const Heat& level);
-	CompilerRecipe& optimization(std::string&& level);
+	Shard& shard(std::string_view path);
 
-	bool rebuild_needed() const override;
-	std::vector<std::string> get_command() const override;
+  public:
+	Stamp stamp(std::string_view path);
+	void forget(std::string_view path);
+	void clear();
+
+	static StatCache& shared();
 };
 
-class LineCook
+inline StatCache::Shard& StatCache::shard(std::string_view path)
 {
-  private:
-	std::vector<Recipe*> m_Recipes;
-	static int cook(Recipe* recipe);
+	return m_Shards[std::hash<std::string_view>()(path) % SHARDS];
+}
 
-  public:
-	LineCook& learn_recipe(Recipe* recipe);
-	int cook();
-	void dessert();
-	void operator+=(Recipe* recipe);
-};
+inline Stamp StatCache::stamp(std::string_view path)
+{
+	auto& shard = this->shard(path);
+	{
+		std::lock_guard<std::mutex> lock(shard.m_Lock);
+		auto it = shard.m_Entries.find(path);
+		if (it != shard.m_Entries.end() && it->second.m_Known) return it->second.m_Stamp;
+	}
 
-enum class Heat { O0, O1, O2, O3, Ofast, Os, Oz, Og };
+	auto fresh = Sink::stamp(std::string(path));
+	std::lock_guard<std::mutex> lock(shard.m_Lock);
+	auto it = shard.m_Entries.find(path);
+	if (it == shard.m_Entries.end()) it = shard.m_Entries.emplace(shard.m_Paths.emplace_back(path), Entry()).first;
+	it->second = {fresh, true};
+	return fresh;
+}
 
-inline void Ingredients::operator+=(const std::string& file)
+inline void StatCache::forget(std::string_view path)
 {
-	(void)add_ingredients(file);
+	auto& shard = this->shard(path);
+	std::lock_guard<std::mutex> lock(shard.m_Lock);
+	auto it = shard.m_Entries.find(path);
+	if (it != shard.m_Entries.end()) it->second.m_Known = false;
 }
 
-inline int cook(Recipe* recipe)
+inline void StatCache::clear()
 {
-	int status = 0;
-
-	if (recipe->rebuild_needed()) {
-		auto command = recipe->get_command();
-		Kitchen::Sink::print_command(command);
-		status = Kitchen::Sink::start_job_sync(std::move(command));
+	for (auto& shard : m_Shards) {
+		std::lock_guard<std::mutex> lock(shard.m_Lock);
+		for (auto& [path, entry] : shard.m_Entries)
+			entry.m_Known = false;
 	}
-	return status;
 }
 
-inline Ingredients& Ingredients::prefix(const std::string& value)
+inline StatCache& StatCache::shared()
 {
-	m_Prefix = value;
-	return *this;
+	static StatCache cache;
+	return cache;
 }
 
-inline Ingredients& Ingredients::add_ingredients(const std ::string& value)
+inline Stamp cached_stamp(std::string_view path)
 {
-	m_Files.push_back(value);
-	return *this;
+	return StatCache::shared().stamp(path);
 }
 
-inline std::vector<std::string> Ingredients::get_ingredients() const
+inline std::optional<uint64_t> hash_file(const std::string& path, uint64_t seed)
 {
-	std::vector<std::string> ret;
-
-	for (auto file_str : m_Files) {
-		auto file = std::filesystem::path(file_str).make_preferred().string();
-		if (m_Prefix != "" && file.find(m_Prefix) == 0)
-			ret.push_back(file.substr(m_Prefix.length()));
-		else
-			ret.push_back(file);
-	}
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) return std::nullopt;
 
-	if (!m_Prefix.empty())
-		for (size_t i = 0; i < m_Files.size(); ++i)
-			ret[i] = m_Prefix + ret[i];
+	char buffer[1 << 16];
+	size_t read;
+	while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+		seed = hash(std::string_view(buffer, read), seed);
+	bool failed = std::ferror(file) != 0;
+	std::fclose(file);
+	if (failed) return std::nullopt;
+	return seed;
+}
 
-	return ret;
+inline std::string hex(uint64_t value)
+{
+	char text[17];
+	std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+	return text;
 }
 
-inline CompilerRecipe& CompilerRecipe::optimization(const Heat& level)
+// Content hashes of files, remembered for as long as their stamp stays the
+// same so headers shared by many translation units are only read once.
+class Digests
 {
-	std::string opt_level;
-	switch (level) {
-	case Heat::O0: opt_level = "-O0"; break;
-	case Heat::O1: opt_level = "-O1"; break;
-	case Heat::O2: opt_level = "-O2"; break;
-	case Heat::O3: opt_level = "-O3"; break;
-	case Heat::Ofast: opt_level = "-Ofast"; break;
-	case Heat::Os: opt_level = "-Os"; break;
-	case Heat::Oz: opt_level = "-Oz"; break;
-	case Heat::Og: opt_level = "-Og"; break;
+  private:
+	std::unordered_map<std::string, std::pair<Stamp, uint64_t>> m_Digests;
+	std::mutex m_Lock;
+
+  public:
+	std::optional<uint64_t> of(const std::string& path);
+};
+
+inline std::optional<uint64_t> Digests::of(const std::string& path)
+{
+	auto stamp = cached_stamp(path);
+	if (!stamp.m_Exists) return std::nullopt;
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		auto it = m_Digests.find(path);
+		if (it != m_Digests.end() && it->second.first.m_Mtime == stamp.m_Mtime
+			&& it->second.first.m_Size == stamp.m_Size)
+			return it->second.second;
 	}
-	m_Command.push_back(opt_level);
-	return *this;
+
+	auto hashed = hash_file(path, hash({}));
+	if (!hashed.has_value()) return std::nullopt;
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Digests[path] = {stamp, *hashed};
+	return hashed;
 }
 
-inline CompilerRecipe& CompilerRecipe::optimization(std::string&& level)
+// One message between LineCook and a worker: a sequence of fields, each a
+// 32-bit little-endian length followed by its bytes. Messages are framed the
+// same way on the wire.
+class Parcel
 {
-	if (level.find("-") != 0) level = "-" + level;
-	m_Command.push_back(level);
-	return *this;
-}
+  private:
+	std::string m_Bytes;
+	size_t m_Read = 0;
+	bool m_Good = true;
 
-#define str_pusher(method, push)                                                                                       \
-	inline CompilerRecipe& CompilerRecipe::method(const std::string& value)                                            \
-	{                                                                                                                  \
-		m_Command.push_back(push);                                                                                     \
-		return *this;                                                                                                  \
-	}
-str_pusher(compiler, value);
-str_pusher(std_version, "-std=" + value);
-#undef str_pusher
+	static bool transfer(int fd, char* data, size_t size, bool sending);
 
-inline CompilerRecipe& CompilerRecipe::push(const std::vector<std::string>& flags)
+  public:
+	Parcel() = default;
+	explicit Parcel(std::string bytes);
+
+	Parcel& put(std::string_view field);
+	Parcel& put(uint64_t value);
+	std::string take();
+	uint64_t number();
+	size_t count(size_t fields = 1);
+	bool good() const;
+	const std::string& bytes() const;
+
+	bool send(int fd) const;
+	static std::optional<Parcel> receive(int fd);
+};
+
+inline Parcel::Parcel(std::string bytes) : m_Bytes(std::move(bytes)) {}
+
+inline Parcel& Parcel::put(std::string_view field)
 {
-	for (const auto& flag : flags)
-		m_Command.push_back(flag);
+	for (int shift = 0; shift < 32; shift += 8)
+		m_Bytes.push_back(char((field.size() >> shift) & 0xff));
+	m_Bytes.append(field);
 	return *this;
 }
 
-inline CompilerRecipe& CompilerRecipe::cache(bool value)
+inline Parcel& Parcel::put(uint64_t value)
 {
-	m_Cache = value;
-	return *this;
+	return put(std::to_string(value));
 }
 
-inline CompilerRecipe& CompilerRecipe::files(const Ingredients& value)
+// Fields past the end leave the parcel no longer good and come out empty.
+inline std::string Parcel::take()
 {
-	m_Files = value;
-	for (std::filesystem::path file : m_Files->get_ingredients())
-		m_Command.push_back(file);
-	return *this;
+	if (!m_Good || m_Bytes.size() - m_Read < 4) {
+		m_Good = false;
+		return {};
+	}
+	size_t size = 0;
+	for (int i = 0; i < 4; ++i)
+		size |= size_t(uint8_t(m_Bytes[m_Read + i])) << (8 * i);
+	m_Read += 4;
+	if (m_Bytes.size() - m_Read < size) {
+		m_Good = false;
+		return {};
+	}
+	m_Read += size;
+	return m_Bytes.substr(m_Read - size, size);
 }
 
-inline CompilerRecipe& CompilerRecipe::cache()
+inline uint64_t Parcel::number()
 {
-	m_Cache = !m_Cache;
-	return *this;
+	auto field = take();
+	char* end = nullptr;
+	uint64_t value = std::strtoull(field.c_str(), &end, 10);
+	if (field.empty() || *end != '\0') m_Good = false;
+	return value;
 }
 
-inline CompilerRecipe& CompilerRecipe::output(const std::string& value)
+// How many items follow, each made of `fields` fields. Every field takes at
+// least its length, so a count that cannot fit in the rest of the parcel
+// leaves it no longer good and comes out as zero, before anyone sizes a
+// container by it.
+inline size_t Parcel::count(size_t fields)
 {
-	m_Output = value;
-	m_Output = m_Output.make_preferred();
-	m_Command.push_back("-o");
-	m_Command.push_back(m_Output.string());
-	auto output = m_Output;
-	auto path = output.remove_filename();
-	if (!std::filesystem::exists(path) && path.has_relative_path()) std::filesystem::create_directories(path);
-	return *this;
+	uint64_t value = number();
+	if (m_Good && value <= (m_Bytes.size() - m_Read) / (4 * fields)) return size_t(value);
+	m_Good = false;
+	return 0;
 }
 
-inline std::vector<std::string> CompilerRecipe::get_command() const
+inline bool Parcel::good() const
 {
-	assert((m_Files.has_value() && "ERROR: you need to provide files to compile"));
-
-	return m_Command;
+	return m_Good;
 }
 
-inline bool CompilerRecipe::rebuild_needed() const
+inline const std::string& Parcel::bytes() const
 {
-	if (!m_Cache) return true;
+	return m_Bytes;
+}
 
-	bool should_rebuild = false;
-	std::filesystem::path output = m_Output.string();
+inline bool Parcel::transfer(int fd, char* data, size_t size, bool sending)
+{
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+	while (size > 0) {
+		ssize_t done = sending ? ::send(fd, data, size, flags) : ::recv(fd, data, size, 0);
+		if (done < 0 && errno == EINTR) continue;
+		if (done <= 0) return false;
+		data += done;
+		size -= done;
+	}
+	return true;
+}
+
+inline bool Parcel::send(int fd) const
+{
+	if (m_Bytes.size() > UINT32_MAX) return false;
+	char length[4];
+	for (int i = 0; i < 4; ++i)
+		length[i] = char((m_Bytes.size() >> (8 * i)) & 0xff);
+	return transfer(fd, length, 4, true) && transfer(fd, const_cast<char*>(m_Bytes.data()), m_Bytes.size(), true);
+}
+
+inline std::optional<Parcel> Parcel::receive(int fd)
+{
+	char length[4];
+	if (!transfer(fd, length, 4, false)) return std::nullopt;
+	size_t size = 0;
+	for (int i = 0; i < 4; ++i)
+		size |= size_t(uint8_t(length[i])) << (8 * i);
+	// Grown as the bytes arrive, so a bogus length costs no more than what
+	// was actually sent.
+	std::string bytes;
+	while (bytes.size() < size) {
+		size_t done = bytes.size();
+		bytes.resize(done + std::min<size_t>(size - done, 1 << 20));
+		if (!transfer(fd, bytes.data() + done, bytes.size() - done, false)) return std::nullopt;
+	}
+	return Parcel(std::move(bytes));
+}
+
+// Unix stream sockets that jobs do not inherit and that never raise SIGPIPE.
+// Where SOCK_CLOEXEC or MSG_NOSIGNAL are missing, as on macOS, both are set on
+// the socket itself.
+inline int seal_socket(int fd)
+{
+#ifndef SOCK_CLOEXEC
+	if (fd >= 0) ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	if (fd >= 0) ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	return fd;
+}
+
+inline int open_socket()
+{
+#ifdef SOCK_CLOEXEC
+	return seal_socket(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+#else
+	return seal_socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+#endif
+}
+
+inline int accept_socket(int listener)
+{
+#ifdef SOCK_CLOEXEC
+	return seal_socket(::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC));
+#else
+	return seal_socket(::accept(listener, nullptr, nullptr));
+#endif
+}
+
+// Make-style dependency file as written by `-MMD -MF`. The whole file is read
+// into one buffer and unescaped in place; inputs are views into that buffer.
+class Depfile
+{
+  private:
+	std::string m_Buffer;
+	std::vector<std::string_view> m_Inputs;
+
+  public:
+	bool load(const std::filesystem::path& path);
+	const std::vector<std::string_view>& inputs() const;
+};
+
+inline bool Depfile::load(const std::filesystem::path& path)
+{
+	m_Inputs.clear();
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) return false;
+
+	std::fseek(file, 0, SEEK_END);
+	long size = std::ftell(file);
+	std::fseek(file, 0, SEEK_SET);
+	m_Buffer.resize(size > 0 ? size : 0);
+	size_t read = std::fread(m_Buffer.data(), 1, m_Buffer.size(), file);
+	std::fclose(file);
+	if (read != m_Buffer.size()) return false;
+
+	auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+	char* in = m_Buffer.data();
+	char* end = in + m_Buffer.size();
+	char* out = in;
+
+	while (in < end) {
+		if (blank(*in)) {
+			++in;
+			continue;
+		}
+		if (*in == '\\' && in + 1 < end && (in[1] == '\n' || in[1] == '\r')) {
+			in += 2;
+			continue;
+		}
+
+		char* start = out;
+		while (in < end && !blank(*in)) {
+			if (*in == '\\' && in + 1 < end) {
+				if (in[1] == '\n' || in[1] == '\r') break;
+				if (in[1] == ' ' || in[1] == '#') {
+					*out++ = in[1];
+					in += 2;
+					continue;
+				}
+			}
+			if (*in == '$' && in + 1 < end && in[1] == '$') ++in;
+			*out++ = *in++;
+		}
+
+		std::string_view token(start, out - start);
+		if (!token.empty() && token.back() != ':') m_Inputs.push_back(token);
+	}
+	return true;
+}
+
+inline const std::vector<std::string_view>& Depfile::inputs() const
+{
+	return m_Inputs;
+}
+
+// True when the depfile is missing or lists an input that is gone or newer
+// than `built`, in nanoseconds as stamped.
+inline bool depfile_changed(const std::filesystem::path& depfile, int64_t built)
+{
+	Depfile deps;
+	if (!deps.load(depfile)) return true;
+
+	for (const auto& input : deps.inputs()) {
+		auto stamp = cached_stamp(input);
+		if (!stamp.m_Exists || stamp.m_Mtime > built) return true;
+	}
+	return false;
+}
+
+// True when `target` is missing or older than any of `inputs`.
+inline bool outdated(const std::string& target, const std::vector<std::string>& inputs)
+{
+	auto built = cached_stamp(target);
+	if (!built.m_Exists) return true;
+	for (const auto& input : inputs) {
+		auto stamp = cached_stamp(input);
+		if (!stamp.m_Exists || built.m_Mtime < stamp.m_Mtime) return true;
+	}
+	return false;
+}
+
+// Splits a command such as "ccache g++" into its words, since the spawned
+// program is the first argument rather than a shell command line.
+inline std::vector<std::string> words(const std::string& text)
+{
+	std::vector<std::string> result;
+	std::stringstream ss(text);
+	for (std::string word; ss >> word;)
+		result.push_back(word);
+	return result;
+}
+
+inline void stage(int stage)
+{
+	std::stringstream ss;
+	ss << "====== STAGE ";
+	ss << stage;
+	ss << " ======";
+	Kitchen::Sink::log(Kitchen::Sink::LogLevel::INFO, ss.str());
+}
+
+inline constexpr const char* HEADER = __FILE__;
+inline constexpr const char* KITCHEN = ".flavortown";
+
+// Content hash of the build script, this header and the compiler they are
+// built with.
+inline std::string recipe_hash(const std::string& source)
+{
+	uint64_t result = hash(CC);
+	for (const std::string& path : {source, std::string(HEADER)})
+		result = hash_file(path, hash(path, result)).value_or(0);
+	return hex(result);
+}
+
+inline std::string read_stamp(const std::filesystem::path& path)
+{
+	std::string text;
+	if (FILE* file = std::fopen(path.c_str(), "r")) {
+		char buffer[64];
+		size_t read = std::fread(buffer, 1, sizeof(buffer), file);
+		text.assign(buffer, read);
+		std::fclose(file);
+	}
+	return text;
+}
+
+inline void write_stamp(const std::filesystem::path& path, const std::string& text)
+{
+	if (FILE* file = std::fopen(path.c_str(), "w")) {
+		std::fwrite(text.data(), 1, text.size(), file);
+		std::fclose(file);
+	}
+}
+
+inline std::optional<std::string> read_file(const std::filesystem::path& path)
+{
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) return std::nullopt;
+	std::string text;
+	char buffer[1 << 16];
+	size_t read;
+	while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+		text.append(buffer, read);
+	bool failed = std::ferror(file) != 0;
+	std::fclose(file);
+	if (failed) return std::nullopt;
+	return text;
+}
+
+inline bool write_file(const std::filesystem::path& path, std::string_view text)
+{
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+	return std::fclose(file) == 0 && written;
+}
+
+// Files and subdirectories of an open directory, without "." and "..".
+// Symbolic links to directories are left out so a walk cannot loop.
+inline void list_directory(int fd, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+	auto sort = [&](const char* name, unsigned char type) {
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) return;
+		struct stat info;
+		if (type == DT_UNKNOWN || type == DT_LNK) {
+			if (::fstatat(fd, name, &info, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) != 0) return;
+			if (S_ISREG(info.st_mode)) type = DT_REG;
+			else if (S_ISDIR(info.st_mode) && type == DT_UNKNOWN) type = DT_DIR;
+		}
+		if (type == DT_REG) files.emplace_back(name);
+		else if (type == DT_DIR) directories.emplace_back(name);
+	};
+
+#ifdef __linux__
+	struct Entry
+	{
+		uint64_t m_Inode;
+		int64_t m_Offset;
+		unsigned short m_Length;
+		unsigned char m_Type;
+		char m_Name[1];
+	};
+	alignas(Entry) char buffer[1 << 15];
+	long read;
+	while ((read = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0)
+		for (long offset = 0; offset < read;) {
+			auto* entry = reinterpret_cast<Entry*>(buffer + offset);
+			sort(entry->m_Name, entry->m_Type);
+			offset += entry->m_Length;
+		}
+#else
+	int copy = ::dup(fd);
+	DIR* directory = copy >= 0 ? ::fdopendir(copy) : nullptr;
+	if (directory == nullptr) {
+		if (copy >= 0) ::close(copy);
+		return;
+	}
+	while (dirent* entry = ::readdir(directory))
+		sort(entry->d_name, entry->d_type);
+	::closedir(directory);
+#endif // __linux__
+}
+
+// Whether `path` matches `pattern` segment by segment, where "**" stands for
+// any number of directories other than hidden ones. With `below` it is
+// whether some path below `path` could still match.
+inline bool glob_match(const std::vector<std::string>& pattern, size_t p, const std::vector<std::string>& path,
+					   size_t s, bool below)
+{
+	if (s == path.size()) {
+		if (below) return p < pattern.size();
+		return p == pattern.size() || (pattern[p] == "**" && glob_match(pattern, p + 1, path, s, below));
+	}
+	if (p == pattern.size()) return false;
+	if (pattern[p] == "**")
+		return glob_match(pattern, p + 1, path, s, below)
+			   || (path[s][0] != '.' && glob_match(pattern, p, path, s + 1, below));
+	return ::fnmatch(pattern[p].c_str(), path[s].c_str(), FNM_PERIOD) == 0
+		   && glob_match(pattern, p + 1, path, s + 1, below);
+}
+
+// Directory listings from earlier builds, each kept with the mtime its
+// directory had when it was read. Adding, removing or renaming an entry bumps
+// that mtime, so a directory that still has it is not read again. Every
+// directory is still opened and stat'ed, because a change deep in a tree
+// leaves the mtimes of the directories above it alone.
+class Cupboard
+{
+  public:
+	struct Listing
+	{
+		int64_t m_Mtime = 0;
+		std::vector<std::string> m_Files;
+		std::vector<std::string> m_Directories;
+	};
+
+  private:
+	static constexpr const char* MAGIC = "flvtdir";
+	static constexpr uint32_t VERSION = 1;
+
+	std::filesystem::path m_Path;
+	std::unordered_map<std::string, Listing> m_Listings;
+	std::mutex m_Lock;
+	bool m_Loaded = false;
+	bool m_Dirty = false;
+
+	void load();
+
+  public:
+	explicit Cupboard(std::filesystem::path path);
+
+	std::optional<Listing> find(const std::string& directory, int64_t mtime);
+	void store(const std::string& directory, Listing listing);
+	bool save();
+
+	static Cupboard& shared();
+};
+
+inline Cupboard::Cupboard(std::filesystem::path path) : m_Path(std::move(path)) {}
+
+// A truncated or corrupt file is thrown away whole.
+inline void Cupboard::load()
+{
+	m_Loaded = true;
+	auto bytes = read_file(m_Path);
+	if (!bytes.has_value()) return;
+
+	Parcel parcel(std::move(*bytes));
+	if (parcel.take() != MAGIC || parcel.number() != VERSION) return;
+	size_t count = parcel.count(4);
+	for (size_t i = 0; i < count && parcel.good(); ++i) {
+		auto directory = parcel.take();
+		Listing listing;
+		listing.m_Mtime = int64_t(parcel.number());
+		listing.m_Files.resize(parcel.count());
+		for (auto& file : listing.m_Files)
+			file = parcel.take();
+		listing.m_Directories.resize(parcel.count());
+		for (auto& subdirectory : listing.m_Directories)
+			subdirectory = parcel.take();
+		m_Listings[directory] = std::move(listing);
+	}
+	if (!parcel.good()) m_Listings.clear();
+}
+
+inline std::optional<Cupboard::Listing> Cupboard::find(const std::string& directory, int64_t mtime)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (!m_Loaded) load();
+	auto it = m_Listings.find(directory);
+	if (it == m_Listings.end() || it->second.m_Mtime != mtime) return std::nullopt;
+	return it->second;
+}
+
+// A directory changed within the last second may change again without its
+// mtime moving on, so its listing is not kept.
+inline void Cupboard::store(const std::string& directory, Listing listing)
+{
+	auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch());
+	if (now.count() - listing.m_Mtime < 1000000000) return;
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (!m_Loaded) load();
+	m_Listings[directory] = std::move(listing);
+	m_Dirty = true;
+}
+
+inline bool Cupboard::save()
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (!m_Dirty) return true;
+
+	Parcel parcel;
+	parcel.put(MAGIC).put(VERSION).put(m_Listings.size());
+	for (const auto& [directory, listing] : m_Listings) {
+		parcel.put(directory).put(uint64_t(listing.m_Mtime)).put(listing.m_Files.size());
+		for (const auto& file : listing.m_Files)
+			parcel.put(file);
+		parcel.put(listing.m_Directories.size());
+		for (const auto& subdirectory : listing.m_Directories)
+			parcel.put(subdirectory);
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(m_Path.parent_path(), ec);
+	auto partial = m_Path;
+	partial += ".tmp";
+	if (!write_file(partial, parcel.bytes())) return false;
+	std::filesystem::rename(partial, m_Path, ec);
+	m_Dirty = ec.value() != 0;
+	return !m_Dirty;
+}
+
+inline Cupboard& Cupboard::shared()
+{
+	static Cupboard cupboard(std::filesystem::path(KITCHEN) / "listings");
+	return cupboard;
+}
+
+// Recompiles the build script and restarts it, unless the script, this header
+// and the compiler all hash the same as for the running executable. The header
+// is precompiled once per content so rebuilds after editing the script only
+// compile the script itself.
+inline void rebuild_yourself(int argc, char** argv, const std::string& source, bool force)
+{
+	std::string executable_name = get_executable_name(std::filesystem::path(source).filename().string());
+	std::filesystem::path kitchen = KITCHEN;
+	std::filesystem::path stamp = kitchen / (executable_name + ".hash");
+	std::string recipe = recipe_hash(source);
+	if (!force && read_stamp(stamp) == recipe && std::filesystem::exists(executable_name)) return;
+
+	stage(0);
+	log(LogLevel::INFO, "Rebuilding " + executable_name + "...");
+	std::filesystem::create_directories(kitchen);
+
+	std::vector<std::string> flags = {"-DGUY_FIERI", "-DDUMB_MESSAGES", "-DCC=\"" CC "\"", "-O1"};
+	bool clang = std::string_view(CC).find("clang") != std::string_view::npos;
+	std::filesystem::path precompiled = kitchen / (clang ? "build.hh.pch" : "build.hh.gch");
+	std::filesystem::path precompiled_stamp = kitchen / "build.hh.hash";
+
+	uint64_t header = hash_file(HEADER, hash(CC)).value_or(0);
+	for (const auto& flag : flags)
+		header = hash(flag, header);
+	bool usable = read_stamp(precompiled_stamp) == hex(header) && std::filesystem::exists(precompiled);
+	if (!usable) {
+		std::vector<std::string> command = words(CC);
+		command.insert(command.end(), flags.begin(), flags.end());
+		command.insert(command.end(), {"-x", "c++-header", HEADER, "-o", precompiled.string()});
+		usable = start_job_sync(command, true).m_Status == 0;
+		if (usable) write_stamp(precompiled_stamp, hex(header));
+		else log(LogLevel::WARN, "could not precompile " + std::string(HEADER) + ", rebuilding without it");
+	}
+
+	std::vector<std::string> command = words(CC);
+	command.insert(command.end(), flags.begin(), flags.end());
+	if (usable && clang) command.insert(command.end(), {"-include-pch", precompiled.string()});
+	if (usable && !clang) command.insert(command.end(), {"-include", (kitchen / "build.hh").string()});
+	command.insert(command.end(), {"-o", executable_name, source});
+
+	int status = start_job_sync(command);
+	if (status != 0) {
+		log(LogLevel::ERROR, "Rebuilding " + executable_name + " has failed, aborting...");
+		std::exit(status);
+	}
+	write_stamp(stamp, recipe);
+
+	std::string executable = "./" + executable_name;
+	std::vector<char*> new_argv = {const_cast<char*>(executable.c_str())};
+	for (int i = 1; i < argc; ++i)
+		new_argv.push_back(argv[i]);
+	new_argv.push_back(nullptr);
+	log(LogLevel::INFO, "Rebuilt, restarting...");
+	std::cout.flush();
+	execv(executable.c_str(), new_argv.data());
+	log(LogLevel::ERROR, "could not restart " + executable + ": " + std::strerror(errno));
+	std::exit(1);
+}
+
+} // namespace Sink
+
+enum class Heat;
+
+class Recipe
+{
+  private:
+	std::vector<Recipe*> m_Dependencies;
+
+  public:
+	virtual ~Recipe(){};
+	virtual std::vector<std::string> get_command() const = 0;
+	virtual bool rebuild_needed() const = 0;
+	virtual std::vector<Recipe*> prep();
+	virtual std::string target() const;
+	virtual std::vector<std::string> inputs() const;
+	virtual std::string depfile() const;
+	virtual std::vector<std::string> preprocess_command(const std::string& output) const;
+	// Brings an existing target up to date in place when only its inputs have
+	// changed; empty when it has to be built from scratch. Asked before every
+	// build of the target, even one that can only go from scratch.
+	virtual std::vector<std::string> update_command() const;
+	// Whether the target alone stands for everything the recipe produced. Only
+	// such targets go through the pantry or cut off their dependents when
+	// rebuilt byte for byte.
+	virtual bool self_contained() const;
+	// Inputs made by other recipes whose bytes are not reproducible, such as
+	// precompiled headers. The pantry keys them by how they were made.
+	virtual std::vector<const Recipe*> made_inputs() const;
+	// Does the work inside this process instead of spawning get_command(),
+	// which then only names the work for the build log.
+	virtual bool in_process() const;
+	virtual Sink::JobResult run() const;
+
+	Recipe& depends_on(Recipe* recipe);
+	const std::vector<Recipe*>& dependencies() const;
+};
+
+class Ingredients;
+
+class Ingredients
+{
+  private:
+	std::vector<std::string> m_Files;
+	std::string m_Prefix;
+
+  public:
+	Ingredients() = default;
+	Ingredients(Ingredients&& rhs) = default;
+	Ingredients(const Ingredients& rhs) = default;
+	Ingredients& operator=(const Ingredients& rhs) = default;
+	Ingredients& prefix(const std::string& prefix);
+	Ingredients& add_ingredients(const std::string& file);
+	Ingredients& glob(const std::string& pattern, const std::vector<std::string>& excludes = {});
+	void operator+=(const std::string& file);
+
+	std::vector<std::string> get_ingredients() const;
+};
+
+class CompilerRecipe;
+
+class ObjectRecipe : public Recipe
+{
+  private:
+	const CompilerRecipe* m_Parent;
+	std::string m_Source;
+	std::string m_Object;
+
+  public:
+	ObjectRecipe(const CompilerRecipe* parent, std::string source, std::string object);
+
+	const std::string& source() const;
+	const std::string& object() const;
+
+	std::string target() const override;
+	std::vector<std::string> inputs() const override;
+	std::string depfile() const override;
+	std::vector<std::string> preprocess_command(const std::string& output) const override;
+	bool self_contained() const override;
+	std::vector<const Recipe*> made_inputs() const override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+};
+
+// Precompiles a header once so CompilerRecipes that take it through
+// precompiled() skip re-parsing it in every translation unit. Builds a .gch
+// for gcc and a .pch for clang, and must use the same flags as its consumers.
+class PchRecipe : public Recipe
+{
+  private:
+	bool m_Cache = false;
+	std::string m_Header;
+	std::filesystem::path m_Output;
+	std::vector<std::string> m_Command;
+
+	bool clang() const;
+
+  public:
+	PchRecipe& header(const std::string& header);
+	PchRecipe& output(const std::string& name);
+	PchRecipe& compiler(const std::string& compiler);
+	PchRecipe& std_version(const std::string& version);
+	PchRecipe& cache();
+	PchRecipe& cache(bool cache);
+	PchRecipe& push(const std::vector<std::string>& flags);
+	PchRecipe& optimization(const Heat& level);
+	PchRecipe& optimization(std::string&& level);
+	PchRecipe& depends_on(Recipe* recipe);
+
+	std::vector<std::string> include_flags() const;
+	std::vector<std::string> preprocess_flags() const;
+
+	std::string target() const override;
+	std::vector<std::string> inputs() const override;
+	std::string depfile() const override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+};
+
+class CompilerRecipe : public Recipe
+{
+  private:
+	bool m_Cache = false;
+	std::filesystem::path m_Output;
+	std::optional<Ingredients> m_Files;
+	std::vector<std::string> m_Sources;
+	std::vector<std::string> m_Command;
+	std::optional<std::filesystem::path> m_ObjectDir;
+	std::vector<std::shared_ptr<ObjectRecipe>> m_Objects;
+	std::vector<std::string> m_ObjectFlags;
+	std::vector<PchRecipe*> m_Precompiled;
+	std::vector<Recipe*> m_Reads;
+	size_t m_Unity = 0;
+	std::unordered_set<std::string> m_Standalone;
+	bool m_SplitDwarf = false;
+
+	std::unordered_set<std::string> sources() const;
+	std::vector<std::string> batch(const std::vector<std::string>& sources) const;
+
+  public:
+	CompilerRecipe() = default;
+	CompilerRecipe(std::string name) : m_Cache(false), m_Output(), m_Files(std::nullopt){};
+
+	CompilerRecipe(const CompilerRecipe& rhs) = default;
+	CompilerRecipe(CompilerRecipe&& rhs) = default;
+
+	CompilerRecipe& files(const Ingredients& files);
+	CompilerRecipe& output(const std::string& name);
+	CompilerRecipe& compiler(const std::string& compiler);
+	CompilerRecipe& std_version(const std::string& version);
+	CompilerRecipe& cache();
+	CompilerRecipe& cache(bool cache);
+	CompilerRecipe& push(const std::vector<std::string>& flags);
+	CompilerRecipe& optimization(const Heat& level);
+	CompilerRecipe& optimization(std::string&& level);
+	CompilerRecipe& depends_on(Recipe* recipe);
+	CompilerRecipe& objects(const std::string& directory);
+	CompilerRecipe& precompiled(PchRecipe* header);
+	CompilerRecipe& reads(Recipe* recipe);
+	CompilerRecipe& unity(size_t batch);
+	CompilerRecipe& exclude_from_unity(const std::string& file);
+	CompilerRecipe& split_dwarf();
+
+	bool cached() const;
+	std::vector<std::string> shared_inputs() const;
+	std::vector<std::string> object_files() const;
+	std::vector<std::string> object_command(const std::string& source, const std::string& object) const;
+	std::vector<std::string> object_preprocess_command(const std::string& source, const std::string& output) const;
+
+	std::vector<Recipe*> prep() override;
+	std::string target() const override;
+	std::vector<std::string> inputs() const override;
+	std::string depfile() const override;
+	std::vector<std::string> preprocess_command(const std::string& output) const override;
+	bool self_contained() const override;
+	std::vector<const Recipe*> made_inputs() const override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+};
+
+// Static library made of the objects of CompilerRecipes and any other object
+// files. Once it exists it is brought up to date in place, replacing only the
+// members whose stamp changed since it was last written. A thin archive only
+// records the paths of its members, which keeps that update cheap.
+class ArchiveRecipe : public Recipe
+{
+  private:
+	std::string m_Archiver = "ar";
+	std::filesystem::path m_Output;
+	std::vector<std::string> m_Files;
+	std::vector<const CompilerRecipe*> m_Compilers;
+	bool m_Thin = false;
+
+	std::string manifest() const;
+
+  public:
+	ArchiveRecipe& output(const std::string& name);
+	ArchiveRecipe& archiver(const std::string& archiver);
+	ArchiveRecipe& files(const Ingredients& files);
+	ArchiveRecipe& objects(CompilerRecipe* recipe);
+	ArchiveRecipe& thin(bool thin = true);
+	ArchiveRecipe& depends_on(Recipe* recipe);
+
+	std::string target() const override;
+	std::vector<std::string> inputs() const override;
+	bool self_contained() const override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+	std::vector<std::string> update_command() const override;
+};
+
+// Links objects and archives into an executable or shared library through the
+// compiler driver. The linker itself can be swapped for mold or lld, which
+// spread the link over several threads.
+class LinkerRecipe : public Recipe
+{
+  private:
+	std::string m_Driver = "c++";
+	std::string m_Linker;
+	size_t m_Threads = 0;
+	std::filesystem::path m_Output;
+	std::vector<std::string> m_Files;
+	std::vector<const CompilerRecipe*> m_Compilers;
+	std::vector<const ArchiveRecipe*> m_Archives;
+	std::vector<std::string> m_Flags;
+
+  public:
+	LinkerRecipe& compiler(const std::string& driver);
+	LinkerRecipe& output(const std::string& name);
+	LinkerRecipe& files(const Ingredients& files);
+	LinkerRecipe& objects(CompilerRecipe* recipe);
+	LinkerRecipe& archive(ArchiveRecipe* recipe);
+	LinkerRecipe& push(const std::vector<std::string>& flags);
+	LinkerRecipe& linker(const std::string& linker);
+	LinkerRecipe& threads(size_t count);
+	LinkerRecipe& depends_on(Recipe* recipe);
+
+	std::string target() const override;
+	std::vector<std::string> inputs() const override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+};
+
+// Profile-guided ThinLTO build of one program in three stages: an instrumented
+// build, a training run of it whose raw profiles are merged, and the optimized
+// build that uses the merged profile. The ThinLTO cache is kept between builds,
+// so relinking after a small change only redoes the modules that changed. An
+// unchanged profile leaves the optimized objects alone. Needs clang and
+// llvm-profdata.
+class PgoRecipe : public Recipe
+{
+  private:
+	// One job between the builds, such as merging the raw profiles.
+	class Step : public Recipe
+	{
+	  public:
+		std::vector<std::string> m_Command;
+		std::vector<std::string> m_Inputs;
+		std::string m_Target;
+
+		std::string target() const override;
+		std::vector<std::string> inputs() const override;
+		bool rebuild_needed() const override;
+		std::vector<std::string> get_command() const override;
+	};
+
+	// The training run of the instrumented binary. Its target records a digest
+	// of the raw profiles it left, so the same profiles cut off the merge.
+	class Tasting : public Step
+	{
+	  public:
+		std::filesystem::path m_Raw;
+
+		bool in_process() const override;
+		Sink::JobResult run() const override;
+	};
+
+	std::string m_Compiler = "clang++";
+	std::string m_Profdata = "llvm-profdata";
+	std::string m_Linker = "lld";
+	std::vector<std::string> m_Flags;
+	std::vector<std::string> m_LinkFlags;
+	std::vector<std::string> m_Training;
+	Ingredients m_Files;
+	std::filesystem::path m_Output;
+	std::optional<std::filesystem::path> m_Directory;
+	std::optional<std::filesystem::path> m_LtoCache;
+
+	std::unique_ptr<CompilerRecipe> m_Instrumented;
+	std::unique_ptr<LinkerRecipe> m_InstrumentedLink;
+	std::unique_ptr<Tasting> m_Tasting;
+	std::unique_ptr<Step> m_Blending;
+	std::unique_ptr<CompilerRecipe> m_Optimized;
+	std::unique_ptr<LinkerRecipe> m_Link;
+
+	std::filesystem::path directory() const;
+
+  public:
+	PgoRecipe& compiler(const std::string& compiler);
+	PgoRecipe& std_version(const std::string& version);
+	PgoRecipe& optimization(const Heat& level);
+	PgoRecipe& optimization(std::string&& level);
+	PgoRecipe& push(const std::vector<std::string>& flags);
+	PgoRecipe& link(const std::vector<std::string>& flags);
+	PgoRecipe& files(const Ingredients& files);
+	PgoRecipe& output(const std::string& name);
+	PgoRecipe& train(const std::vector<std::string>& arguments);
+	PgoRecipe& directory(const std::string& directory);
+	PgoRecipe& lto_cache(const std::string& directory);
+	PgoRecipe& profdata(const std::string& tool);
+	PgoRecipe& linker(const std::string& linker);
+	PgoRecipe& depends_on(Recipe* recipe);
+
+	std::string instrumented() const;
+	std::string profile() const;
+
+	std::vector<Recipe*> prep() override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+};
+
+// Runs a C++ callable on LineCook's pool instead of spawning a process, for
+// small generation steps such as embedding assets or generating tables. It is
+// rebuilt like any other recipe when its inputs are newer than its output or
+// its version changes, and cuts off its dependents when it writes the same
+// bytes again. The callable returns a status; an exception counts as failure.
+class FunctionRecipe : public Recipe
+{
+  private:
+	std::string m_Name;
+	std::string m_Version;
+	std::function<int()> m_Body;
+	std::vector<std::string> m_Inputs;
+	std::filesystem::path m_Output;
+
+  public:
+	explicit FunctionRecipe(std::string name);
+
+	FunctionRecipe& body(std::function<int()> body);
+	FunctionRecipe& version(const std::string& version);
+	FunctionRecipe& files(const Ingredients& files);
+	FunctionRecipe& output(const std::string& name);
+	FunctionRecipe& depends_on(Recipe* recipe);
+
+	std::string target() const override;
+	std::vector<std::string> inputs() const override;
+	bool rebuild_needed() const override;
+	std::vector<std::string> get_command() const override;
+	bool in_process() const override;
+	Sink::JobResult run() const override;
+};
+
+// Fixed pool of workers, each with its own queue of tasks. A worker takes the
+// most urgent task from its own queue and steals the most urgent one from the
+// others when it runs dry.
+class Brigade
+{
+  private:
+	struct Task
+	{
+		size_t m_Priority;
+		std::function<void()> m_Work;
+
+		bool operator<(const Task& rhs) const
+		{
+			return m_Priority < rhs.m_Priority;
+		}
+	};
+
+	struct Station
+	{
+		std::mutex m_Lock;
+		std::vector<Task> m_Tasks;
+	};
+
+	std::vector<std::unique_ptr<Station>> m_Stations;
+	std::vector<std::thread> m_Cooks;
+	std::mutex m_Lock;
+	std::condition_variable m_Ready;
+	std::condition_variable m_Idle;
+	size_t m_Queued = 0;
+	size_t m_Pending = 0;
+	size_t m_Next = 0;
+	bool m_Closing = false;
+
+	static inline thread_local long t_Station = -1;
+
+	bool take(size_t station, std::function<void()>& task);
+	void work(size_t station);
+
+  public:
+	explicit Brigade(size_t cooks);
+	Brigade(const Brigade&) = delete;
+	Brigade& operator=(const Brigade&) = delete;
+	~Brigade();
+
+	void submit(std::function<void()> task, size_t priority = 0);
+	void wait();
+	size_t size() const;
+	static long station();
+};
+
+// On-disk record of every target LineCook produced: the hash of the command
+// that built it, a fingerprint of its inputs, its mtime and how long it took.
+// Records are appended after each run; later records replace earlier ones and
+// the file is rewritten once dead records outnumber live ones.
+class Ledger
+{
+  public:
+	struct Entry
+	{
+		uint64_t m_Command = 0;
+		uint64_t m_Inputs = 0;
+		int64_t m_Mtime = 0;
+		uint64_t m_Digest = 0;
+		uint32_t m_Duration = 0;
+		uint32_t m_Memory = 0;
+	};
+
+  private:
+	static constexpr char MAGIC[8] = {'f', 'l', 'v', 't', 'l', 'o', 'g', '\0'};
+	static constexpr uint32_t VERSION = 3;
+
+	std::filesystem::path m_Path;
+	std::unordered_map<std::string, Entry> m_Entries;
+	std::vector<std::pair<std::string, Entry>> m_Fresh;
+	std::mutex m_Lock;
+	size_t m_Records = 0;
+	bool m_Loaded = false;
+
+  public:
+	explicit Ledger(std::filesystem::path path);
+
+	bool load();
+	bool save();
+	bool loaded() const;
+	const Entry* find(const std::string& target) const;
+	void record(const std::string& target, const Entry& entry);
+};
+
+// Local content-addressed store of compiled outputs and their depfiles.
+// Entries are keyed by the hash of the full command plus either the contents
+// of every file the previous depfile lists or, without a depfile, the
+// preprocessed source. Hits are restored by reflink, hardlink or copy, and the
+// least recently used entries are evicted once the store outgrows its
+// capacity.
+class Pantry
+{
+  private:
+	std::filesystem::path m_Directory;
+	uint64_t m_Capacity;
+	std::atomic<uint64_t> m_Hits{0};
+	std::atomic<uint64_t> m_Misses{0};
+	std::atomic<uint64_t> m_Stored{0};
+	Sink::Digests m_Digests;
+
+	std::filesystem::path shelf(uint64_t key) const;
+	std::optional<uint64_t> provenance(const Recipe* maker);
+	static bool restore(const std::filesystem::path& from, const std::filesystem::path& to);
+	void evict();
+
+  public:
+	Pantry(std::filesystem::path directory, uint64_t capacity);
+
+	std::optional<uint64_t> key(const Recipe* recipe, uint64_t command, bool* exact = nullptr);
+	bool fetch(uint64_t key, const Recipe* recipe);
+	void store(uint64_t key, const Recipe* recipe);
+	void miss();
+	void close();
+};
+
+// Start and end of every job LineCook ran, written out in the Chrome
+// trace_event format so chrome://tracing or Perfetto can display the build.
+class Timeline
+{
+  public:
+	struct Event
+	{
+		size_t m_Order;
+		std::string m_Name;
+		int64_t m_Start;
+		int64_t m_End;
+		long m_Station;
+		int m_Status;
+		bool m_Cached;
+	};
+
+  private:
+	std::chrono::steady_clock::time_point m_Epoch = std::chrono::steady_clock::now();
+	std::vector<Event> m_Events;
+	std::mutex m_Lock;
+
+  public:
+	int64_t now() const;
+	void record(Event event);
+	void clear();
+	const std::vector<Event>& events() const;
+	bool write(const std::string& path) const;
+};
+
+// Memory that the jobs in flight are expected to need at their peak. A job is
+// only let in while the total fits the budget. When nothing is running, a job
+// is always let in, so an estimate bigger than the machine cannot stall the
+// build.
+class Countertop
+{
+  private:
+	uint64_t m_Budget;
+	uint64_t m_Used = 0;
+	size_t m_Jobs = 0;
+	size_t m_Widest = 0;
+	bool m_Held = false;
+	std::mutex m_Lock;
+	std::condition_variable m_Freed;
+
+  public:
+	explicit Countertop(uint64_t budget);
+
+	void claim(uint64_t bytes);
+	void clear(uint64_t bytes);
+	uint64_t budget() const;
+	size_t held();
+
+	static uint64_t available();
+};
+
+// Where LineCook's jobs run.
+class Executor
+{
+  public:
+	virtual ~Executor() = default;
+	virtual Sink::JobResult run(const Recipe* recipe, const std::vector<std::string>& command, bool capture) = 0;
+};
+
+// Spawns every job on this machine.
+class LocalExecutor : public Executor
+{
+  public:
+	Sink::JobResult run(const Recipe* recipe, const std::vector<std::string>& command, bool capture) override;
+};
+
+// Sends jobs to flavortown-worker daemons listening on Unix sockets, each to
+// the worker with the fewest jobs in flight. Inputs are named by content: the
+// worker asks only for those its store lacks, runs the command in a scratch
+// directory and sends back the target and depfile. Which files a job reads is
+// found by running the preprocessor here first. Absolute paths, such as the
+// toolchain and system headers, must be the same for the workers. Jobs
+// without a depfile or whose inputs reach outside the project run here, and
+// so does everything once no worker can be reached.
+class RemoteExecutor : public Executor
+{
+  private:
+	struct Worker
+	{
+		std::string m_Socket;
+		std::atomic<size_t> m_Running{0};
+		std::atomic<bool> m_Down{false};
+	};
+
+	std::deque<Worker> m_Workers;
+	std::atomic<size_t> m_Next{0};
+	LocalExecutor m_Local;
+	Sink::Digests m_Digests;
+
+	static std::optional<std::vector<std::string>> manifest(const Recipe* recipe);
+	Worker* pick();
+	std::optional<Sink::JobResult> send(Worker& worker, const Recipe* recipe, const std::vector<std::string>& command,
+										const std::vector<std::string>& inputs);
+
+  public:
+	explicit RemoteExecutor(const std::vector<std::string>& sockets);
+
+	Sink::JobResult run(const Recipe* recipe, const std::vector<std::string>& command, bool capture) override;
+};
+
+class LineCook
+{
+  private:
+	struct Order
+	{
+		Recipe* m_Recipe = nullptr;
+		std::vector<Recipe*> m_Dependencies;
+		std::vector<size_t> m_Dependents;
+		std::atomic<size_t> m_Waiting{0};
+		std::atomic<bool> m_Forced{false};
+		std::atomic<bool> m_Restat{false};
+		bool m_Stale = true;
+		size_t m_Cost = 1;
+		size_t m_Priority = 0;
+	};
+
+	// What became of a target: left alone, rewritten with the same contents or
+	// changed.
+	enum class Outcome { UNTOUCHED, RESTATED, CHANGED };
+
+	// State shared by every job of a single cook() run.
+	struct Shift
+	{
+		Ledger m_Ledger;
+		std::optional<Pantry> m_Pantry;
+		Timeline m_Timeline;
+		bool m_Live = false;
+		std::optional<Countertop> m_Countertop;
+		uint64_t m_Estimate = 0;
+		Executor* m_Executor = nullptr;
+	};
+
+	std::vector<Recipe*> m_Recipes;
+	size_t m_Jobs = std::max(1u, std::thread::hardware_concurrency());
+	std::string m_Ledger = ".flavortown_log";
+	std::string m_Pantry;
+	uint64_t m_PantryCapacity = 0;
+	std::string m_Trace;
+	size_t m_Summary = 0;
+	std::optional<size_t> m_Watch;
+	size_t m_KeepGoing = 1;
+	uint64_t m_Estimate = 0;
+	uint64_t m_Budget = 0;
+	std::shared_ptr<Executor> m_Executor = std::make_shared<LocalExecutor>();
+
+	static uint64_t fingerprint(const Recipe* recipe);
+	static bool stale(const Recipe* recipe, const Ledger& ledger, uint64_t command);
+	static int cook(Order& order, Shift& shift, size_t index, Outcome& outcome);
+	std::vector<std::pair<Recipe*, std::vector<Recipe*>>> menu() const;
+	static bool plan(std::vector<Order>& orders);
+	int serve(std::vector<Order>& orders, const std::vector<bool>& selected, Shift& shift, Brigade& brigade) const;
+	void wrap_up(const std::vector<Order>& orders, Shift& shift) const;
+	int simmer(std::vector<Order>& orders, Shift& shift, Brigade& brigade) const;
+	void report(const std::vector<Order>& orders, const Timeline& timeline) const;
+
+  public:
+	LineCook& learn_recipe(Recipe* recipe);
+	LineCook& jobs(size_t count);
+	LineCook& ledger(const std::string& path);
+	LineCook& pantry(const std::string& directory, uint64_t capacity = 5ull << 30);
+	LineCook& trace(const std::string& path);
+	LineCook& summary(size_t slowest = 10);
+	LineCook& watch(size_t debounce = 2);
+	LineCook& keep_going(size_t failures = 0);
+	LineCook& memory(uint64_t estimate, uint64_t budget = 0);
+	LineCook& executor(std::shared_ptr<Executor> executor);
+	LineCook& remote(const std::vector<std::string>& sockets);
+	LineCook& args(int argc, char** argv);
+	int cook();
+	void dessert();
+	void operator+=(Recipe* recipe);
+};
+
+enum class Heat { O0, O1, O2, O3, Ofast, Os, Oz, Og };
+
+inline void Ingredients::operator+=(const std::string& file)
+{
+	(void)add_ingredients(file);
+}
+
+// Hash of every direct and depfile input's path, mtime and size.
+inline uint64_t LineCook::fingerprint(const Recipe* recipe)
+{
+	uint64_t result = Sink::hash({});
+	auto bytes = [](const int64_t& value) {
+		return std::string_view(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	auto mix = [&](std::string_view path) {
+		auto stamp = Sink::cached_stamp(path);
+		result = Sink::hash(path, result);
+		result = Sink::hash(bytes(stamp.m_Mtime), result);
+		result = Sink::hash(bytes(stamp.m_Size), result);
+	};
+
+	for (const auto& input : recipe->inputs())
+		mix(input);
+
+	Sink::Depfile deps;
+	auto depfile = recipe->depfile();
+	if (!depfile.empty() && deps.load(depfile))
+		for (const auto& input : deps.inputs())
+			mix(input);
+	return result;
+}
+
+// A ledger entry catches what mtime ordering alone misses: changed flags,
+// inputs replaced by older files and outputs touched behind our back. Targets
+// the ledger has never seen are only trusted before the ledger exists.
+inline bool LineCook::stale(const Recipe* recipe, const Ledger& ledger, uint64_t command)
+{
+	auto target = recipe->target();
+	if (target.empty()) return recipe->rebuild_needed();
+
+	const Ledger::Entry* entry = ledger.find(target);
+	if (entry == nullptr) return ledger.loaded() || recipe->rebuild_needed();
+
+	auto output = Sink::cached_stamp(target);
+	if (!output.m_Exists || output.m_Mtime != entry->m_Mtime || entry->m_Command != command) return true;
+	if (entry->m_Inputs != fingerprint(recipe)) return true;
+	return recipe->rebuild_needed();
+}
+
+// Cooks one order unless it is up to date. Its staleness was settled before
+// scheduling and only needs another look if a dependency has changed since.
+// A rebuilt target whose contents match the last build is reported as
+// restated, which lets its dependents be skipped: they only get their own
+// target touched so the next build still sees them as up to date.
+inline int LineCook::cook(Order& order, Shift& shift, size_t index, Outcome& outcome)
+{
+	Recipe* recipe = order.m_Recipe;
+	auto command = recipe->get_command();
+	uint64_t hash = Sink::hash_command(command);
+	auto target = recipe->target();
+	auto& ledger = shift.m_Ledger;
+	auto& stats = Sink::StatCache::shared();
+	auto digest = [&target]() { return Sink::hash_file(target, Sink::hash({})).value_or(0); };
+
+	// A recipe without a command only gathers its dependencies and passes on
+	// what became of them.
+	if (command.empty()) {
+		outcome = order.m_Forced ? Outcome::CHANGED : order.m_Restat ? Outcome::RESTATED : Outcome::UNTOUCHED;
+		return 0;
+	}
+
+	outcome = Outcome::UNTOUCHED;
+	bool checked = !order.m_Stale && !order.m_Forced;
+	if (checked || !stale(recipe, ledger, hash)) {
+		if (target.empty()) return 0;
+		const Ledger::Entry* entry = ledger.find(target);
+		if (entry == nullptr) {
+			ledger.record(target, {hash, fingerprint(recipe), Sink::cached_stamp(target).m_Mtime, digest(), 0});
+		} else if (order.m_Restat) {
+			std::error_code ec;
+			std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now(), ec);
+			stats.forget(target);
+			ledger.record(target, {hash, fingerprint(recipe), Sink::cached_stamp(target).m_Mtime, entry->m_Digest,
+								   entry->m_Duration, entry->m_Memory});
+			outcome = Outcome::RESTATED;
+		}
+		return 0;
+	}
+
+	outcome = Outcome::CHANGED;
+	auto depfile = recipe->depfile();
+	auto settle = [&](uint64_t fresh) {
+		const Ledger::Entry* previous = ledger.find(target);
+		if (fresh != 0 && previous != nullptr && previous->m_Digest == fresh && recipe->self_contained())
+			outcome = Outcome::RESTATED;
+	};
+
+	auto& timeline = shift.m_Timeline;
+	auto name = !target.empty() ? target : command.size() > 1 ? command[0] + " " + command[1] : command[0];
+	int64_t start = timeline.now();
+
+	std::optional<uint64_t> key;
+	bool exact = false;
+	bool shelved = shift.m_Pantry.has_value() && recipe->self_contained();
+	if (shelved) {
+		key = shift.m_Pantry->key(recipe, hash, &exact);
+		if (key.has_value() && shift.m_Pantry->fetch(*key, recipe)) {
+			stats.forget(target);
+			stats.forget(depfile);
+			timeline.record({index, name, start, timeline.now(), Brigade::station(), 0, true});
+			Sink::log(Sink::LogLevel::INFO, "CACHED: " + target);
+			auto fresh = digest();
+			settle(fresh);
+			const Ledger::Entry* previous = ledger.find(target);
+			ledger.record(target, {hash, fingerprint(recipe), Sink::cached_stamp(target).m_Mtime, fresh,
+								   previous != nullptr ? previous->m_Duration : 0,
+								   previous != nullptr ? previous->m_Memory : 0});
+			return 0;
+		}
+		if (key.has_value()) shift.m_Pantry->miss();
+	}
+
+	// Only inputs changed since the last build with this very command, so the
+	// recipe may be able to bring its target up to date in place.
+	const Ledger::Entry* previous = target.empty() ? nullptr : ledger.find(target);
+	std::vector<std::string> update = target.empty() ? std::vector<std::string>() : recipe->update_command();
+	if (previous == nullptr || previous->m_Command != hash || !Sink::cached_stamp(target).m_Exists) update.clear();
+
+	// Never write through an old output otherwise: it may be hardlinked into
+	// the pantry.
+	std::error_code ec;
+	if (update.empty() && !target.empty() && std::filesystem::is_regular_file(target, ec))
+		std::filesystem::remove(target, ec);
+
+	uint64_t memory = shift.m_Estimate;
+	if (previous != nullptr && previous->m_Memory > 0) memory = uint64_t(previous->m_Memory) << 10;
+	bool admitted = shift.m_Countertop.has_value() && !recipe->in_process() && memory > 0;
+	if (admitted) shift.m_Countertop->claim(memory);
+
+	const auto& job = update.empty() ? command : update;
+	Kitchen::Sink::print_command(job);
+	int64_t spawned = timeline.now();
+	auto result = recipe->in_process() ? recipe->run() : shift.m_Executor->run(recipe, job, !shift.m_Live);
+	int64_t finished = timeline.now();
+	if (admitted) shift.m_Countertop->clear(memory);
+	stats.forget(target);
+	stats.forget(depfile);
+	Kitchen::Sink::print_job_output(result);
+	int status = result.m_Status;
+	timeline.record({index, name, start, finished, Brigade::station(), status, false});
+
+	if (status == 0 && !target.empty()) {
+		auto duration = (finished - spawned) / 1000;
+		auto fresh = digest();
+		settle(fresh);
+		auto peak = uint32_t(std::min<uint64_t>(result.m_PeakRss >> 10, UINT32_MAX));
+		ledger.record(target, {hash, fingerprint(recipe), Sink::cached_stamp(target).m_Mtime, fresh,
+							   uint32_t(duration), peak});
+
+		// A lookup key from the previous depfile is only a hint and nothing is
+		// filed under it; the output goes under what this compile just read.
+		if (shelved) {
+			auto fresh = shift.m_Pantry->key(recipe, hash);
+			if (key.has_value() && exact) shift.m_Pantry->store(*key, recipe);
+			if (fresh.has_value() && fresh != key) shift.m_Pantry->store(*fresh, recipe);
+		}
+	}
+	return status;
+}
+
+inline std::vector<Recipe*> Recipe::prep()
+{
+	return {};
+}
+
+inline std::string Recipe::target() const
+{
+	return {};
+}
+
+inline std::vector<std::string> Recipe::inputs() const
+{
+	return {};
+}
+
+inline std::string Recipe::depfile() const
+{
+	return {};
+}
+
+inline std::vector<std::string> Recipe::preprocess_command(const std::string& output) const
+{
+	(void)output;
+	return {};
+}
+
+inline std::vector<std::string> Recipe::update_command() const
+{
+	return {};
+}
+
+inline bool Recipe::self_contained() const
+{
+	return true;
+}
+
+inline std::vector<const Recipe*> Recipe::made_inputs() const
+{
+	return {};
+}
+
+inline bool Recipe::in_process() const
+{
+	return false;
+}
+
+inline Sink::JobResult Recipe::run() const
+{
+	return Sink::start_job_sync(get_command(), true);
+}
+
+inline Recipe& Recipe::depends_on(Recipe* recipe)
+{
+	m_Dependencies.push_back(recipe);
+	return *this;
+}
+
+inline const std::vector<Recipe*>& Recipe::dependencies() const
+{
+	return m_Dependencies;
+}
+
+inline Ingredients& Ingredients::prefix(const std::string& value)
+{
+	m_Prefix = value;
+	return *this;
+}
+
+inline Ingredients& Ingredients::add_ingredients(const std ::string& value)
+{
+	m_Files.push_back(value);
+	return *this;
+}
+
+// Adds the files matching `pattern` and none of `excludes`, in sorted order.
+// "*", "?" and "[...]" match within one path segment and "**" any number of
+// directories; hidden entries only match a pattern that names them. The walk
+// starts below the pattern's leading segments without wildcards, reads
+// directories in parallel and skips those that cannot match or are excluded.
+inline Ingredients& Ingredients::glob(const std::string& pattern, const std::vector<std::string>& excludes)
+{
+	auto split = [](const std::string& path) {
+		std::vector<std::string> segments;
+		std::stringstream parts(path);
+		for (std::string part; std::getline(parts, part, '/');)
+			if (!part.empty() && part != ".") segments.push_back(part);
+		return segments;
+	};
+	auto wanted = split(pattern);
+	std::vector<std::vector<std::string>> unwanted;
+	for (const auto& exclude : excludes)
+		unwanted.push_back(split(exclude));
+	auto excluded = [&unwanted](const std::vector<std::string>& path) {
+		return std::any_of(unwanted.begin(), unwanted.end(),
+						   [&path](const auto& exclude) { return Sink::glob_match(exclude, 0, path, 0, false); });
+	};
+
+	auto join = [](const std::string& directory, const std::string& name) {
+		return directory.empty() ? name : directory.back() == '/' ? directory + name : directory + "/" + name;
+	};
+
+	std::string root = !pattern.empty() && pattern[0] == '/' ? "/" : "";
+	size_t fixed = 0;
+	for (; fixed + 1 < wanted.size() && wanted[fixed].find_first_of("*?[") == std::string::npos; ++fixed)
+		root = join(root, wanted[fixed]);
+	std::vector<std::string> start(wanted.begin(), wanted.begin() + fixed);
+	int fd = ::open(root.empty() ? "." : root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (wanted.empty() || fd < 0 || excluded(start)) {
+		if (fd >= 0) ::close(fd);
+		return *this;
+	}
+
+	auto& cupboard = Sink::Cupboard::shared();
+	std::vector<std::string> found;
+	std::mutex lock;
+	Brigade brigade(std::max(1u, std::thread::hardware_concurrency()));
+
+	// Each task owns the directory it was handed and opens its subdirectories
+	// relative to it before passing them on.
+	std::function<void(int, std::string, std::vector<std::string>)> visit;
+	visit = [&](int fd, std::string directory, std::vector<std::string> segments) {
+		struct stat info;
+		int64_t mtime = ::fstat(fd, &info) == 0 ? Sink::stamp_of(info).m_Mtime : 0;
+		auto listing = cupboard.find(directory, mtime);
+		if (!listing.has_value()) {
+			listing.emplace();
+			listing->m_Mtime = mtime;
+			Sink::list_directory(fd, listing->m_Files, listing->m_Directories);
+			cupboard.store(directory, *listing);
+		}
+
+		std::vector<std::string> matched;
+		for (const auto& file : listing->m_Files) {
+			segments.push_back(file);
+			if (Sink::glob_match(wanted, 0, segments, 0, false) && !excluded(segments))
+				matched.push_back(join(directory, file));
+			segments.pop_back();
+		}
+		if (!matched.empty()) {
+			std::lock_guard<std::mutex> guard(lock);
+			found.insert(found.end(), matched.begin(), matched.end());
+		}
+
+		for (const auto& subdirectory : listing->m_Directories) {
+			segments.push_back(subdirectory);
+			int child = -1;
+			if (Sink::glob_match(wanted, 0, segments, 0, true) && !excluded(segments))
+				child = ::openat(fd, subdirectory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+			if (child >= 0)
+				brigade.submit([&, child, path = join(directory, subdirectory), segments]() {
+					visit(child, path, segments);
+				});
+			segments.pop_back();
+		}
+		::close(fd);
+	};
+	brigade.submit([&]() { visit(fd, root, start); });
+	brigade.wait();
+	cupboard.save();
+
+	std::sort(found.begin(), found.end());
+	for (auto& file : found)
+		m_Files.push_back(std::move(file));
+	return *this;
+}
+
+inline std::vector<std::string> Ingredients::get_ingredients() const
+{
+	std::vector<std::string> ret;
+
+	for (auto file_str : m_Files) {
+		auto file = std::filesystem::path(file_str).make_preferred().string();
+		if (m_Prefix != "" && file.find(m_Prefix) == 0)
+			ret.push_back(file.substr(m_Prefix.length()));
+		else
+			ret.push_back(file);
+	}
+
+	if (!m_Prefix.empty())
+		for (size_t i = 0; i < m_Files.size(); ++i)
+			ret[i] = m_Prefix + ret[i];
+
+	return ret;
+}
+
+inline std::string heat_flag(const Heat& level)
+{
+	std::string opt_level;
+	switch (level) {
+	case Heat::O0: opt_level = "-O0"; break;
+	case Heat::O1: opt_level = "-O1"; break;
+	case Heat::O2: opt_level = "-O2"; break;
+	case Heat::O3: opt_level = "-O3"; break;
+	case Heat::Ofast: opt_level = "-Ofast"; break;
+	case Heat::Os: opt_level = "-Os"; break;
+	case Heat::Oz: opt_level = "-Oz"; break;
+	case Heat::Og: opt_level = "-Og"; break;
+	}
+	return opt_level;
+}
+
+inline CompilerRecipe& CompilerRecipe::optimization(const Heat& level)
+{
+	m_Command.push_back(heat_flag(level));
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::optimization(std::string&& level)
+{
+	if (level.find("-") != 0) level = "-" + level;
+	m_Command.push_back(level);
+	return *this;
+}
+
+#define str_pusher(recipe, method, push)                                                                               \
+	inline recipe& recipe::method(const std::string& value)                                                            \
+	{                                                                                                                  \
+		m_Command.push_back(push);                                                                                     \
+		return *this;                                                                                                  \
+	}
+str_pusher(CompilerRecipe, std_version, "-std=" + value);
+str_pusher(PchRecipe, std_version, "-std=" + value);
+#undef str_pusher
+
+inline CompilerRecipe& CompilerRecipe::compiler(const std::string& compiler)
+{
+	for (auto& word : Sink::words(compiler))
+		m_Command.push_back(std::move(word));
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::compiler(const std::string& compiler)
+{
+	for (auto& word : Sink::words(compiler))
+		m_Command.push_back(std::move(word));
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::push(const std::vector<std::string>& flags)
+{
+	for (const auto& flag : flags)
+		m_Command.push_back(flag);
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::cache(bool value)
+{
+	m_Cache = value;
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::depends_on(Recipe* recipe)
+{
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::files(const Ingredients& value)
+{
+	m_Files = value;
+	m_Sources = m_Files->get_ingredients();
+	for (const auto& file : m_Sources)
+		m_Command.push_back(file);
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::cache()
+{
+	m_Cache = !m_Cache;
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::output(const std::string& value)
+{
+	m_Output = value;
+	m_Output = m_Output.make_preferred();
+	m_Command.push_back("-o");
+	m_Command.push_back(m_Output.string());
+	auto output = m_Output;
+	auto path = output.remove_filename();
+	if (!std::filesystem::exists(path) && path.has_relative_path()) std::filesystem::create_directories(path);
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::objects(const std::string& directory)
+{
+	m_ObjectDir = std::filesystem::path(directory).make_preferred();
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::precompiled(PchRecipe* header)
+{
+	m_Precompiled.push_back(header);
+	Recipe::depends_on(header);
+	return *this;
+}
+
+// A generated file every translation unit reads through its flags, such as a
+// profile. Objects wait for it and are rebuilt when it changes.
+inline CompilerRecipe& CompilerRecipe::reads(Recipe* recipe)
+{
+	m_Reads.push_back(recipe);
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::unity(size_t batch)
+{
+	m_Unity = batch;
+	return *this;
+}
+
+inline CompilerRecipe& CompilerRecipe::exclude_from_unity(const std::string& file)
+{
+	m_Standalone.insert(std::filesystem::path(file).make_preferred().string());
+	return *this;
+}
+
+// Debug info goes to a .dwo beside each object instead of through the linker.
+inline CompilerRecipe& CompilerRecipe::split_dwarf()
+{
+	m_SplitDwarf = true;
+	m_Command.push_back("-gsplit-dwarf");
+	return *this;
+}
+
+// The object leaves its debug info to the .dwo next to it.
+inline bool CompilerRecipe::self_contained() const
+{
+	return !m_SplitDwarf;
+}
+
+inline std::vector<const Recipe*> CompilerRecipe::made_inputs() const
+{
+	return std::vector<const Recipe*>(m_Precompiled.begin(), m_Precompiled.end());
+}
+
+inline std::vector<std::string> CompilerRecipe::object_files() const
+{
+	std::vector<std::string> objects;
+	for (const auto& object : m_Objects)
+		objects.push_back(object->object());
+	return objects;
+}
+
+inline bool CompilerRecipe::cached() const
+{
+	return m_Cache;
+}
+
+// Depfiles never mention a precompiled header or a file read through a flag,
+// so these are tracked as direct inputs of every translation unit instead.
+inline std::vector<std::string> CompilerRecipe::shared_inputs() const
+{
+	std::vector<std::string> outputs;
+	for (const auto* header : m_Precompiled)
+		outputs.push_back(header->target());
+	for (const auto* recipe : m_Reads)
+		outputs.push_back(recipe->target());
+	return outputs;
+}
+
+inline std::unordered_set<std::string> CompilerRecipe::sources() const
+{
+	return std::unordered_set<std::string>(m_Sources.begin(), m_Sources.end());
+}
+
+inline std::vector<std::string> CompilerRecipe::object_command(const std::string& source,
+															   const std::string& object) const
+{
+	std::vector<std::string> command = m_ObjectFlags;
+	for (const auto* header : m_Precompiled)
+		for (const auto& flag : header->include_flags())
+			command.push_back(flag);
+	command.push_back("-c");
+	command.push_back(source);
+	command.push_back("-o");
+	command.push_back(object);
+	if (m_Cache) {
+		command.push_back("-MMD");
+		command.push_back("-MF");
+		command.push_back(object + ".d");
+	}
+	return command;
+}
+
+inline std::vector<std::string> CompilerRecipe::object_preprocess_command(const std::string& source,
+																		  const std::string& output) const
+{
+	std::vector<std::string> command = m_ObjectFlags;
+	for (const auto* header : m_Precompiled)
+		for (const auto& flag : header->preprocess_flags())
+			command.push_back(flag);
+	command.push_back("-E");
+	command.push_back(source);
+	command.push_back("-o");
+	command.push_back(output);
+	return command;
+}
+
+// Groups sources into unity translation units of at most m_Unity files each.
+// Batches never span directories and follow sorted order inside one, so
+// adding or removing a file only reshuffles its own directory. A batch file
+// is only rewritten when its member list changes, which keeps its mtime, and
+// its depfile ties it to the sources it includes.
+inline std::vector<std::string> CompilerRecipe::batch(const std::vector<std::string>& sources) const
+{
+	if (m_Unity < 2) return sources;
+
+	std::vector<std::string> units;
+	std::vector<std::string> batchable;
+	for (const auto& source : sources) {
+		if (m_Standalone.count(source) != 0) units.push_back(source);
+		else batchable.push_back(source);
+	}
+	std::sort(batchable.begin(), batchable.end());
+
+	std::vector<std::vector<std::string>> batches;
+	std::filesystem::path directory;
+	for (const auto& source : batchable) {
+		auto parent = std::filesystem::path(source).parent_path();
+		if (batches.empty() || batches.back().size() == m_Unity || parent != directory) batches.emplace_back();
+		batches.back().push_back(source);
+		directory = parent;
+	}
+
+	std::unordered_map<std::string, size_t> counters;
+	for (const auto& members : batches) {
+		if (members.size() == 1) {
+			units.push_back(members.front());
+			continue;
+		}
+
+		auto parent = std::filesystem::path(members.front()).parent_path().lexically_normal();
+		std::filesystem::path relative;
+		for (const auto& part : parent.relative_path())
+			relative /= part == ".." ? std::filesystem::path("__") : part;
+
+		size_t index = counters[relative.string()]++;
+		auto name = "unity_" + std::to_string(index) + std::filesystem::path(members.front()).extension().string();
+		auto unit = *m_ObjectDir / "unity" / relative / name;
+
+		std::string contents;
+		for (const auto& member : members)
+			contents += "#include \"" + std::filesystem::absolute(member).lexically_normal().string() + "\"\n";
+
+		std::string existing;
+		if (FILE* file = std::fopen(unit.c_str(), "rb")) {
+			char buffer[1 << 14];
+			size_t read;
+			while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+				existing.append(buffer, read);
+			std::fclose(file);
+		}
+		if (existing != contents) {
+			std::filesystem::create_directories(unit.parent_path());
+			if (FILE* file = std::fopen(unit.c_str(), "wb")) {
+				std::fwrite(contents.data(), 1, contents.size(), file);
+				std::fclose(file);
+			}
+			Sink::StatCache::shared().forget(unit.string());
+		}
+		units.push_back(unit.string());
+	}
+	return units;
+}
+
+inline std::vector<Recipe*> CompilerRecipe::prep()
+{
+	m_Objects.clear();
+	if (!m_ObjectDir.has_value() || !m_Files.has_value()) return {};
+
+	// Same flags as the full command, minus the sources and the final output.
+	auto skip = sources();
+	m_ObjectFlags.clear();
+	for (size_t i = 0; i < m_Command.size(); ++i) {
+		if (m_Command[i] == "-o" && i + 1 < m_Command.size() && m_Command[i + 1] == m_Output.string()) {
+			++i;
+			continue;
+		}
+		if (skip.count(m_Command[i]) == 0) m_ObjectFlags.push_back(m_Command[i]);
+	}
+
+	std::vector<Recipe*> objects;
+	for (const auto& source : batch(m_Sources)) {
+		std::filesystem::path relative;
+		for (const auto& part : std::filesystem::path(source).lexically_normal().relative_path())
+			relative /= part == ".." ? std::filesystem::path("__") : part;
+
+		// Unity batches already live under the object directory.
+		std::filesystem::path object = *m_ObjectDir / relative;
+		if (source.rfind(m_ObjectDir->string(), 0) == 0) object = source;
+		object += ".o";
+		std::filesystem::create_directories(object.parent_path());
+
+		// Everything the whole command waits for, such as a code generator, the
+		// precompiled headers and the files it reads, each object waits for too.
+		m_Objects.push_back(std::make_shared<ObjectRecipe>(this, source, object.string()));
+		for (auto* recipe : dependencies())
+			m_Objects.back()->depends_on(recipe);
+		objects.push_back(m_Objects.back().get());
+	}
+	return objects;
+}
+
+inline std::string CompilerRecipe::target() const
+{
+	return m_Output.string();
+}
+
+inline std::vector<std::string> CompilerRecipe::inputs() const
+{
+	std::vector<std::string> inputs;
+	if (m_Objects.empty()) {
+		inputs = m_Sources;
+		for (const auto& output : shared_inputs())
+			inputs.push_back(output);
+	}
+	for (const auto& object : m_Objects)
+		inputs.push_back(object->object());
+	return inputs;
+}
+
+// Only a single-source command gets a depfile: with several sources the
+// compiler would overwrite it once per translation unit.
+inline std::string CompilerRecipe::depfile() const
+{
+	if (!m_Cache || !m_Objects.empty() || m_Output.empty()) return {};
+	if (m_Sources.size() != 1) return {};
+	return m_Output.string() + ".d";
+}
+
+inline std::vector<std::string> CompilerRecipe::preprocess_command(const std::string& output) const
+{
+	if (depfile().empty()) return {};
+
+	std::vector<std::string> command;
+	for (size_t i = 0; i < m_Command.size(); ++i) {
+		if (m_Command[i] == "-o" && i + 1 < m_Command.size() && m_Command[i + 1] == m_Output.string()) {
+			++i;
+			continue;
+		}
+		if (m_Command[i] != "-c") command.push_back(m_Command[i]);
+	}
+	for (const auto* header : m_Precompiled)
+		for (const auto& flag : header->preprocess_flags())
+			command.push_back(flag);
+	command.push_back("-E");
+	command.push_back("-o");
+	command.push_back(output);
+	return command;
+}
+
+// Without an output an objects() recipe only compiles, leaving the objects to
+// an ArchiveRecipe or LinkerRecipe.
+inline std::vector<std::string> CompilerRecipe::get_command() const
+{
+	assert((m_Files.has_value() && "ERROR: you need to provide files to compile"));
+	if (!m_Objects.empty() && m_Output.empty()) return {};
+	if (m_Objects.empty()) {
+		auto depfile = this->depfile();
+		if (depfile.empty() && m_Precompiled.empty()) return m_Command;
+
+		auto command = m_Command;
+		for (const auto* header : m_Precompiled)
+			for (const auto& flag : header->include_flags())
+				command.push_back(flag);
+		if (depfile.empty()) return command;
+		command.push_back("-MMD");
+		command.push_back("-MF");
+		command.push_back(depfile);
+		return command;
+	}
+
+	auto skip = sources();
+	std::vector<std::string> command;
+	bool linked = false;
+	for (const auto& argument : m_Command) {
+		if (skip.count(argument) == 0) {
+			command.push_back(argument);
+		} else if (!linked) {
+			for (const auto& object : m_Objects)
+				command.push_back(object->object());
+			linked = true;
+		}
+	}
+	return command;
+}
+
+inline bool CompilerRecipe::rebuild_needed() const
+{
+	if (!m_Cache) return true;
+
+	auto output = Sink::cached_stamp(m_Output.string());
+	if (!output.m_Exists) return true;
+
+	for (const auto& input : inputs()) {
+		auto stamp = Sink::cached_stamp(input);
+		if (!stamp.m_Exists || output.m_Mtime < stamp.m_Mtime) return true;
+	}
+
+	auto depfile = this->depfile();
+	return !depfile.empty() && Sink::depfile_changed(depfile, output.m_Mtime);
+}
+
+inline Brigade::Brigade(size_t cooks)
+{
+	cooks = std::max<size_t>(cooks, 1);
+	for (size_t i = 0; i < cooks; ++i)
+		m_Stations.push_back(std::make_unique<Station>());
+	for (size_t i = 0; i < cooks; ++i)
+		m_Cooks.emplace_back(&Brigade::work, this, i);
+}
+
+inline Brigade::~Brigade()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Closing = true;
+	}
+	m_Ready.notify_all();
+	for (auto& cook : m_Cooks)
+		cook.join();
+}
+
+inline size_t Brigade::size() const
+{
+	return m_Cooks.size();
+}
+
+inline long Brigade::station()
+{
+	return t_Station;
+}
+
+inline void Brigade::submit(std::function<void()> task, size_t priority)
+{
+	size_t station;
+	if (t_Station >= 0) {
+		station = size_t(t_Station) % m_Stations.size();
+	} else {
+		std::lock_guard<std::mutex> lock(m_Lock);
+		station = m_Next++ % m_Stations.size();
+	}
+
+	{
+		auto& tasks = m_Stations[station]->m_Tasks;
+		std::lock_guard<std::mutex> lock(m_Stations[station]->m_Lock);
+		tasks.push_back({priority, std::move(task)});
+		std::push_heap(tasks.begin(), tasks.end());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		++m_Queued;
+		++m_Pending;
+	}
+	m_Ready.notify_one();
+}
+
+inline void Brigade::wait()
+{
+	std::unique_lock<std::mutex> lock(m_Lock);
+	m_Idle.wait(lock, [this]() { return m_Pending == 0; });
+}
+
+inline bool Brigade::take(size_t station, std::function<void()>& task)
+{
+	for (size_t i = 0; i < m_Stations.size(); ++i) {
+		auto& victim = *m_Stations[(station + i) % m_Stations.size()];
+		std::lock_guard<std::mutex> lock(victim.m_Lock);
+		if (victim.m_Tasks.empty()) continue;
+
+		std::pop_heap(victim.m_Tasks.begin(), victim.m_Tasks.end());
+		task = std::move(victim.m_Tasks.back().m_Work);
+		victim.m_Tasks.pop_back();
+		return true;
+	}
+	return false;
+}
+
+inline void Brigade::work(size_t station)
+{
+	t_Station = station;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_Lock);
+			m_Ready.wait(lock, [this]() { return m_Queued > 0 || m_Closing; });
+			if (m_Queued == 0) return;
+			--m_Queued;
+		}
+
+		// Every reservation of m_Queued is backed by a task sitting in some deque.
+		std::function<void()> task;
+		while (!take(station, task))
+			std::this_thread::yield();
+		task();
+
+		std::lock_guard<std::mutex> lock(m_Lock);
+		if (--m_Pending == 0) m_Idle.notify_all();
+	}
+}
+
+inline ObjectRecipe::ObjectRecipe(const CompilerRecipe* parent, std::string source, std::string object)
+	: m_Parent(parent), m_Source(std::move(source)), m_Object(std::move(object))
+{
+}
+
+inline const std::string& ObjectRecipe::source() const
+{
+	return m_Source;
+}
+
+inline const std::string& ObjectRecipe::object() const
+{
+	return m_Object;
+}
+
+inline std::vector<std::string> ObjectRecipe::get_command() const
+{
+	return m_Parent->object_command(m_Source, m_Object);
+}
+
+inline std::string ObjectRecipe::target() const
+{
+	return m_Object;
+}
+
+inline std::vector<std::string> ObjectRecipe::inputs() const
+{
+	std::vector<std::string> inputs = {m_Source};
+	for (const auto& output : m_Parent->shared_inputs())
+		inputs.push_back(output);
+	return inputs;
+}
+
+inline std::string ObjectRecipe::depfile() const
+{
+	return m_Parent->cached() ? m_Object + ".d" : std::string();
+}
+
+inline std::vector<std::string> ObjectRecipe::preprocess_command(const std::string& output) const
+{
+	return m_Parent->object_preprocess_command(m_Source, output);
+}
+
+inline bool ObjectRecipe::self_contained() const
+{
+	return m_Parent->self_contained();
+}
+
+inline std::vector<const Recipe*> ObjectRecipe::made_inputs() const
+{
+	return m_Parent->made_inputs();
+}
+
+inline bool ObjectRecipe::rebuild_needed() const
+{
+	auto built = Sink::cached_stamp(m_Object);
+	if (!m_Parent->cached() || !built.m_Exists) return true;
+
+	for (const auto& input : inputs()) {
+		auto stamp = Sink::cached_stamp(input);
+		if (!stamp.m_Exists || built.m_Mtime < stamp.m_Mtime) return true;
+	}
+	return Sink::depfile_changed(depfile(), built.m_Mtime);
+}
+
+inline bool PchRecipe::clang() const
+{
+	// The compiler is the words before the first flag, e.g. "ccache clang++".
+	for (const auto& word : m_Command) {
+		if (word.rfind("-", 0) == 0) break;
+		if (word.find("clang") != std::string::npos) return true;
+	}
+	return false;
+}
+
+inline PchRecipe& PchRecipe::header(const std::string& value)
+{
+	m_Header = std::filesystem::path(value).make_preferred().string();
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::output(const std::string& value)
+{
+	m_Output = std::filesystem::path(value).make_preferred();
+	auto directory = m_Output.parent_path();
+	if (!directory.empty()) std::filesystem::create_directories(directory);
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::cache()
+{
+	m_Cache = !m_Cache;
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::cache(bool value)
+{
+	m_Cache = value;
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::push(const std::vector<std::string>& flags)
+{
+	for (const auto& flag : flags)
+		m_Command.push_back(flag);
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::optimization(const Heat& level)
+{
+	m_Command.push_back(heat_flag(level));
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::optimization(std::string&& level)
+{
+	if (level.find("-") != 0) level = "-" + level;
+	m_Command.push_back(level);
+	return *this;
+}
+
+inline PchRecipe& PchRecipe::depends_on(Recipe* recipe)
+{
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline std::vector<std::string> PchRecipe::include_flags() const
+{
+	if (clang()) return {"-include-pch", target()};
+
+	auto included = target();
+	if (included.size() > 4 && included.compare(included.size() - 4, 4, ".gch") == 0)
+		included.resize(included.size() - 4);
+	return {"-include", included, "-Winvalid-pch"};
+}
+
+// Preprocessing reads the header itself: gcc has no `X` next to `X.gch`.
+inline std::vector<std::string> PchRecipe::preprocess_flags() const
+{
+	return {"-include", m_Header};
+}
+
+// gcc only finds `X.gch` through `-include X`, so that suffix is enforced.
+inline std::string PchRecipe::target() const
+{
+	std::string target = m_Output.empty() ? m_Header : m_Output.string();
+	std::string suffix = clang() ? ".pch" : ".gch";
+	if (target.size() < suffix.size() || target.compare(target.size() - suffix.size(), suffix.size(), suffix) != 0)
+		target += suffix;
+	return target;
+}
+
+inline std::vector<std::string> PchRecipe::inputs() const
+{
+	return {m_Header};
+}
+
+inline std::string PchRecipe::depfile() const
+{
+	return m_Cache ? target() + ".d" : std::string();
+}
+
+inline bool PchRecipe::rebuild_needed() const
+{
+	auto built = Sink::cached_stamp(target());
+	if (!m_Cache || !built.m_Exists) return true;
+
+	auto header = Sink::cached_stamp(m_Header);
+	return !header.m_Exists || built.m_Mtime < header.m_Mtime || Sink::depfile_changed(depfile(), built.m_Mtime);
+}
+
+inline std::vector<std::string> PchRecipe::get_command() const
+{
+	assert((!m_Command.empty() && !m_Header.empty() && "ERROR: a precompiled header needs a compiler and a header"));
+
+	auto command = m_Command;
+	command.insert(command.end(), {"-x", "c++-header", m_Header, "-o", target()});
+	if (m_Cache) command.insert(command.end(), {"-MMD", "-MF", depfile()});
+	return command;
+}
+
+inline ArchiveRecipe& ArchiveRecipe::output(const std::string& name)
+{
+	m_Output = std::filesystem::path(name).make_preferred();
+	if (m_Output.has_parent_path()) std::filesystem::create_directories(m_Output.parent_path());
+	return *this;
+}
+
+inline ArchiveRecipe& ArchiveRecipe::archiver(const std::string& archiver)
+{
+	m_Archiver = archiver;
+	return *this;
+}
+
+inline ArchiveRecipe& ArchiveRecipe::files(const Ingredients& files)
+{
+	for (const auto& file : files.get_ingredients())
+		m_Files.push_back(file);
+	return *this;
+}
+
+inline ArchiveRecipe& ArchiveRecipe::objects(CompilerRecipe* recipe)
+{
+	m_Compilers.push_back(recipe);
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline ArchiveRecipe& ArchiveRecipe::thin(bool thin)
+{
+	m_Thin = thin;
+	return *this;
+}
+
+inline ArchiveRecipe& ArchiveRecipe::depends_on(Recipe* recipe)
+{
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline std::string ArchiveRecipe::target() const
+{
+	return m_Output.string();
+}
+
+inline std::vector<std::string> ArchiveRecipe::inputs() const
+{
+	std::vector<std::string> members = m_Files;
+	for (const auto* compiler : m_Compilers)
+		for (const auto& object : compiler->object_files())
+			members.push_back(object);
+	return members;
+}
+
+// A thin archive only points at its members.
+inline bool ArchiveRecipe::self_contained() const
+{
+	return !m_Thin;
+}
+
+inline bool ArchiveRecipe::rebuild_needed() const
+{
+	return Sink::outdated(target(), inputs());
+}
+
+inline std::vector<std::string> ArchiveRecipe::get_command() const
+{
+	assert((!m_Output.empty() && "ERROR: an archive needs an output"));
+
+	std::vector<std::string> command{m_Archiver, "rcs"};
+	if (m_Thin) command.push_back("--thin");
+	command.push_back(target());
+	for (const auto& member : inputs())
+		command.push_back(member);
+	return command;
+}
+
+// Stamps of the members as of the last write of the archive, one
+// "<mtime> <size> <path>" per line.
+inline std::string ArchiveRecipe::manifest() const
+{
+	return target() + ".members";
+}
+
+// Members whose stamp differs from the manifest in either direction are
+// replaced, so one swapped for an older file counts too. The manifest is
+// written before the job and only trusted once the archive is newer than it,
+// that is once the job it was written for went through. Without a trusted
+// manifest, with a member gone or with none changed, the archive is rebuilt
+// from scratch. So is it when two members share a file name, since ar
+// replaces members by file name alone.
+inline std::vector<std::string> ArchiveRecipe::update_command() const
+{
+	std::unordered_map<std::string, std::pair<int64_t, int64_t>> recorded;
+	auto written = Sink::stamp(manifest());
+	auto text = Sink::read_file(manifest());
+	if (text.has_value() && Sink::cached_stamp(target()).m_Mtime > written.m_Mtime) {
+		std::stringstream lines(*text);
+		long long mtime, size;
+		std::string path;
+		while (lines >> mtime >> size && std::getline(lines >> std::ws, path))
+			recorded[path] = {mtime, size};
+	}
+	bool trusted = !recorded.empty();
+
+	std::vector<std::string> command{m_Archiver, "rs"};
+	if (m_Thin) command.push_back("--thin");
+	command.push_back(target());
+	std::string lines;
+	bool changed = false;
+	bool clash = false;
+	std::unordered_set<std::string> names;
+	for (const auto& member : inputs()) {
+		clash = clash || !names.insert(std::filesystem::path(member).filename().string()).second;
+		auto stamp = Sink::cached_stamp(member);
+		lines += std::to_string(stamp.m_Mtime) + " " + std::to_string(stamp.m_Size) + " " + member + "\n";
+		auto it = recorded.find(member);
+		bool same = it != recorded.end() && it->second == std::make_pair(stamp.m_Mtime, stamp.m_Size);
+		if (it != recorded.end()) recorded.erase(it);
+		if (same) continue;
+		command.push_back(member);
+		changed = true;
+	}
+
+	Sink::write_file(manifest(), lines);
+	if (!trusted || !changed || clash || !recorded.empty()) return {};
+	return command;
+}
+
+inline LinkerRecipe& LinkerRecipe::compiler(const std::string& driver)
+{
+	m_Driver = driver;
+	return *this;
+}
+
+inline LinkerRecipe& LinkerRecipe::output(const std::string& name)
+{
+	m_Output = std::filesystem::path(name).make_preferred();
+	if (m_Output.has_parent_path()) std::filesystem::create_directories(m_Output.parent_path());
+	return *this;
+}
+
+inline LinkerRecipe& LinkerRecipe::files(const Ingredients& files)
+{
+	for (const auto& file : files.get_ingredients())
+		m_Files.push_back(file);
+	return *this;
+}
+
+inline LinkerRecipe& LinkerRecipe::objects(CompilerRecipe* recipe)
+{
+	m_Compilers.push_back(recipe);
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline LinkerRecipe& LinkerRecipe::archive(ArchiveRecipe* recipe)
+{
+	m_Archives.push_back(recipe);
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline LinkerRecipe& LinkerRecipe::push(const std::vector<std::string>& flags)
+{
+	for (const auto& flag : flags)
+		m_Flags.push_back(flag);
+	return *this;
+}
+
+// mold, lld, gold or bfd, handed to the driver as -fuse-ld.
+inline LinkerRecipe& LinkerRecipe::linker(const std::string& linker)
+{
+	m_Linker = linker;
+	return *this;
+}
+
+// Threads for the linker to use; 0 leaves mold and lld at one per core.
+inline LinkerRecipe& LinkerRecipe::threads(size_t count)
+{
+	m_Threads = count;
+	return *this;
+}
+
+inline LinkerRecipe& LinkerRecipe::depends_on(Recipe* recipe)
+{
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline std::string LinkerRecipe::target() const
+{
+	return m_Output.string();
+}
+
+inline std::vector<std::string> LinkerRecipe::inputs() const
+{
+	std::vector<std::string> inputs = m_Files;
+	for (const auto* compiler : m_Compilers)
+		for (const auto& object : compiler->object_files())
+			inputs.push_back(object);
+	for (const auto* archive : m_Archives)
+		inputs.push_back(archive->target());
+	return inputs;
+}
+
+inline bool LinkerRecipe::rebuild_needed() const
+{
+	return Sink::outdated(target(), inputs());
+}
+
+inline std::vector<std::string> LinkerRecipe::get_command() const
+{
+	assert((!m_Output.empty() && "ERROR: a link needs an output"));
+
+	std::vector<std::string> command = Sink::words(m_Driver);
+	if (!m_Linker.empty()) command.push_back("-fuse-ld=" + m_Linker);
+
+	auto threads = std::to_string(m_Threads);
+	if (m_Linker == "gold")
+		command.push_back(m_Threads > 0 ? "-Wl,--threads,--thread-count=" + threads : "-Wl,--threads");
+	else if (m_Linker == "mold" && m_Threads > 0)
+		command.push_back("-Wl,--thread-count=" + threads);
+	else if (m_Linker == "lld" && m_Threads > 0)
+		command.push_back("-Wl,--threads=" + threads);
+
+	for (const auto& input : inputs())
+		command.push_back(input);
+	for (const auto& flag : m_Flags)
+		command.push_back(flag);
+	command.push_back("-o");
+	command.push_back(target());
+	return command;
+}
+
+inline std::string PgoRecipe::Step::target() const
+{
+	return m_Target;
+}
+
+inline std::vector<std::string> PgoRecipe::Step::inputs() const
+{
+	return m_Inputs;
+}
+
+inline bool PgoRecipe::Step::rebuild_needed() const
+{
+	return Sink::outdated(target(), inputs());
+}
+
+inline std::vector<std::string> PgoRecipe::Step::get_command() const
+{
+	return m_Command;
+}
+
+// Runs in process only to clear out the raw profiles of an older binary first;
+// the binary itself is spawned directly.
+inline bool PgoRecipe::Tasting::in_process() const
+{
+	return true;
+}
+
+inline Sink::JobResult PgoRecipe::Tasting::run() const
+{
+	std::error_code ec;
+	std::filesystem::remove_all(m_Raw, ec);
+	std::filesystem::create_directories(m_Raw, ec);
+	auto result = Sink::start_job_sync(m_Command, true);
+	if (result.m_Status != 0) return result;
+
+	std::vector<std::string> profiles;
+	for (const auto& entry : std::filesystem::directory_iterator(m_Raw, ec))
+		profiles.push_back(entry.path().string());
+	std::sort(profiles.begin(), profiles.end());
+	uint64_t digest = Sink::hash({});
+	for (const auto& profile : profiles)
+		digest = Sink::hash_file(profile, digest).value_or(0);
+	if (profiles.empty() || !Sink::write_file(m_Target, Sink::hex(digest) + "\n")) {
+		result.m_Status = 1;
+		result.m_Errors += "training left no profiles in " + m_Raw.string() + "\n";
+	}
+	return result;
+}
+
+inline PgoRecipe& PgoRecipe::compiler(const std::string& compiler)
+{
+	m_Compiler = compiler;
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::std_version(const std::string& version)
+{
+	m_Flags.push_back("-std=" + version);
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::optimization(const Heat& level)
+{
+	m_Flags.push_back(heat_flag(level));
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::optimization(std::string&& level)
+{
+	if (level.find("-") != 0) level = "-" + level;
+	m_Flags.push_back(level);
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::push(const std::vector<std::string>& flags)
+{
+	for (const auto& flag : flags)
+		m_Flags.push_back(flag);
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::link(const std::vector<std::string>& flags)
+{
+	for (const auto& flag : flags)
+		m_LinkFlags.push_back(flag);
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::files(const Ingredients& files)
+{
+	m_Files = files;
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::output(const std::string& name)
+{
+	m_Output = std::filesystem::path(name).make_preferred();
+	return *this;
+}
+
+// Arguments the instrumented binary is run with to produce the profile.
+inline PgoRecipe& PgoRecipe::train(const std::vector<std::string>& arguments)
+{
+	m_Training = arguments;
+	return *this;
+}
+
+// Where the instrumented build, the profiles and the optimized objects live;
+// defaults to the output with a .pgo suffix.
+inline PgoRecipe& PgoRecipe::directory(const std::string& directory)
+{
+	m_Directory = directory;
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::lto_cache(const std::string& directory)
+{
+	m_LtoCache = directory;
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::profdata(const std::string& tool)
+{
+	m_Profdata = tool;
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::linker(const std::string& linker)
+{
+	m_Linker = linker;
+	return *this;
+}
+
+inline PgoRecipe& PgoRecipe::depends_on(Recipe* recipe)
+{
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline std::filesystem::path PgoRecipe::directory() const
+{
+	return m_Directory.value_or(m_Output.string() + ".pgo");
+}
+
+inline std::string PgoRecipe::instrumented() const
+{
+	return (directory() / "instrumented" / m_Output.filename()).string();
+}
+
+inline std::string PgoRecipe::profile() const
+{
+	return (directory() / "merged.profdata").string();
+}
+
+inline std::vector<Recipe*> PgoRecipe::prep()
+{
+	assert((!m_Output.empty() && !m_Training.empty() && "ERROR: PGO needs an output and a training run"));
+
+	auto directory = this->directory();
+	auto cache = m_LtoCache.value_or(directory / "thinlto");
+	std::filesystem::create_directories(cache);
+
+	// The instrumented binary writes its raw profiles, named after the process,
+	// where the flag says rather than where LLVM_PROFILE_FILE would.
+	auto raw = directory / "raw";
+	auto generate = "-fprofile-instr-generate=" + (raw / "%p-%m.profraw").string();
+	m_Instrumented = std::make_unique<CompilerRecipe>("instrumented");
+	m_Instrumented->compiler(m_Compiler).push(m_Flags).push({generate}).files(m_Files);
+	m_Instrumented->objects((directory / "instrumented").string()).cache(true);
+
+	m_InstrumentedLink = std::make_unique<LinkerRecipe>();
+	m_InstrumentedLink->compiler(m_Compiler).objects(m_Instrumented.get()).push({generate});
+	m_InstrumentedLink->push(m_LinkFlags).output(instrumented());
+
+	m_Tasting = std::make_unique<Tasting>();
+	m_Tasting->m_Raw = raw;
+	m_Tasting->m_Target = (directory / "trained").string();
+	m_Tasting->m_Inputs = {instrumented()};
+	m_Tasting->m_Command = {instrumented()};
+	m_Tasting->m_Command.insert(m_Tasting->m_Command.end(), m_Training.begin(), m_Training.end());
+	m_Tasting->depends_on(m_InstrumentedLink.get());
+
+	m_Blending = std::make_unique<Step>();
+	m_Blending->m_Target = profile();
+	m_Blending->m_Inputs = {m_Tasting->m_Target};
+	m_Blending->m_Command = Sink::words(m_Profdata);
+	m_Blending->m_Command.insert(m_Blending->m_Command.end(), {"merge", "-output=" + profile(), raw.string()});
+	m_Blending->depends_on(m_Tasting.get());
+
+	m_Optimized = std::make_unique<CompilerRecipe>("optimized");
+	m_Optimized->compiler(m_Compiler).push(m_Flags).push({"-fprofile-instr-use=" + profile(), "-flto=thin"});
+	m_Optimized->files(m_Files).objects((directory / "optimized").string()).cache(true).reads(m_Blending.get());
+
+	auto cached = m_Linker == "lld" ? "-Wl,--thinlto-cache-dir=" + cache.string()
+									: "-Wl,-plugin-opt,cache-dir=" + cache.string();
+	m_Link = std::make_unique<LinkerRecipe>();
+	m_Link->compiler(m_Compiler).objects(m_Optimized.get()).linker(m_Linker).push({"-flto=thin", cached});
+	m_Link->push(m_LinkFlags).output(m_Output.string());
+
+	for (Recipe* dependency : dependencies()) {
+		m_Instrumented->depends_on(dependency);
+		m_Tasting->depends_on(dependency);
+		m_Optimized->depends_on(dependency);
+	}
+	return {m_Link.get()};
+}
+
+inline bool PgoRecipe::rebuild_needed() const
+{
+	return false;
+}
+
+// The stages do the work; this recipe only gathers them.
+inline std::vector<std::string> PgoRecipe::get_command() const
+{
+	return {};
+}
+
+inline FunctionRecipe::FunctionRecipe(std::string name) : m_Name(std::move(name)) {}
+
+inline FunctionRecipe& FunctionRecipe::body(std::function<int()> body)
+{
+	m_Body = std::move(body);
+	return *this;
+}
+
+// Stands in for the command line: bump it whenever the callable changes what
+// it writes.
+inline FunctionRecipe& FunctionRecipe::version(const std::string& version)
+{
+	m_Version = version;
+	return *this;
+}
+
+inline FunctionRecipe& FunctionRecipe::files(const Ingredients& files)
+{
+	m_Inputs = files.get_ingredients();
+	return *this;
+}
+
+inline FunctionRecipe& FunctionRecipe::output(const std::string& name)
+{
+	m_Output = std::filesystem::path(name).make_preferred();
+	return *this;
+}
+
+inline FunctionRecipe& FunctionRecipe::depends_on(Recipe* recipe)
+{
+	Recipe::depends_on(recipe);
+	return *this;
+}
+
+inline std::string FunctionRecipe::target() const
+{
+	return m_Output.string();
+}
+
+inline std::vector<std::string> FunctionRecipe::inputs() const
+{
+	return m_Inputs;
+}
+
+inline bool FunctionRecipe::rebuild_needed() const
+{
+	return m_Output.empty() || Sink::outdated(target(), inputs());
+}
+
+inline std::vector<std::string> FunctionRecipe::get_command() const
+{
+	std::vector<std::string> command = {"function:" + m_Name};
+	if (!m_Version.empty()) command.push_back(m_Version);
+	return command;
+}
+
+inline bool FunctionRecipe::in_process() const
+{
+	return true;
+}
+
+inline Sink::JobResult FunctionRecipe::run() const
+{
+	assert((m_Body && "ERROR: you need to provide a body to run"));
+	Sink::JobResult result;
+	try {
+		result.m_Status = m_Body();
+	} catch (const std::exception& error) {
+		result.m_Status = 1;
+		result.m_Errors = m_Name + ": " + error.what() + "\n";
+	} catch (...) {
+		result.m_Status = 1;
+		result.m_Errors = m_Name + ": unknown exception\n";
+	}
+	if (result.m_Status == 0 && !m_Output.empty() && !Sink::stamp(target()).m_Exists) {
+		result.m_Status = 1;
+		result.m_Errors = m_Name + ": did not write " + target() + "\n";
+	}
+	return result;
+}
+
+inline Ledger::Ledger(std::filesystem::path path) : m_Path(std::move(path))
+{
+}
+
+inline bool Ledger::load()
+{
+	m_Entries.clear();
+	m_Records = 0;
+	m_Loaded = false;
+	if (m_Path.empty()) return false;
+
+	FILE* file = std::fopen(m_Path.c_str(), "rb");
+	if (file == nullptr) return false;
+	std::fseek(file, 0, SEEK_END);
+	long size = std::ftell(file);
+	std::fseek(file, 0, SEEK_SET);
+	std::string buffer(size > 0 ? size : 0, '\0');
+	size_t read = std::fread(buffer.data(), 1, buffer.size(), file);
+	std::fclose(file);
+
+	uint32_t version = 0;
+	if (read != buffer.size() || buffer.size() < sizeof(MAGIC) + sizeof(version)) return false;
+	std::memcpy(&version, buffer.data() + sizeof(MAGIC), sizeof(version));
+	if (std::memcmp(buffer.data(), MAGIC, sizeof(MAGIC)) != 0 || version != VERSION) {
+		Sink::log(Sink::LogLevel::WARN, "discarding incompatible build log " + m_Path.string());
+		return false;
+	}
+
+	const char* at = buffer.data() + sizeof(MAGIC) + sizeof(version);
+	const char* end = buffer.data() + buffer.size();
+	for (;;) {
+		uint32_t length;
+		Entry entry;
+		if (size_t(end - at) < sizeof(length)) break;
+		std::memcpy(&length, at, sizeof(length));
+		if (size_t(end - at) < sizeof(length) + length + sizeof(Entry)) break;
+		at += sizeof(length);
+		std::string target(at, length);
+		at += length;
+		std::memcpy(&entry, at, sizeof(Entry));
+		at += sizeof(Entry);
+
+		m_Entries[std::move(target)] = entry;
+		++m_Records;
+	}
+
+	m_Loaded = true;
+	return true;
+}
+
+inline bool Ledger::save()
+{
+	if (m_Path.empty() || m_Fresh.empty()) return true;
+	for (auto& [target, entry] : m_Fresh)
+		m_Entries[target] = entry;
+
+	auto append = [](std::string& buffer, const std::string& target, const Entry& entry) {
+		uint32_t length = target.size();
+		buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		buffer.append(target);
+		buffer.append(reinterpret_cast<const char*>(&entry), sizeof(Entry));
+	};
+
+	std::string buffer;
+	bool rewrite = !m_Loaded || m_Records + m_Fresh.size() > 2 * m_Entries.size() + 1024;
+	if (rewrite) {
+		uint32_t version = VERSION;
+		buffer.append(MAGIC, sizeof(MAGIC));
+		buffer.append(reinterpret_cast<const char*>(&version), sizeof(version));
+		for (const auto& [target, entry] : m_Entries)
+			append(buffer, target, entry);
+		m_Records = m_Entries.size();
+	} else {
+		for (const auto& [target, entry] : m_Fresh)
+			append(buffer, target, entry);
+		m_Records += m_Fresh.size();
+	}
+	m_Fresh.clear();
+
+	FILE* file = std::fopen(m_Path.c_str(), rewrite ? "wb" : "ab");
+	if (file == nullptr) return false;
+	bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	written = std::fclose(file) == 0 && written;
+	m_Loaded = written;
+	return written;
+}
+
+inline bool Ledger::loaded() const
+{
+	return m_Loaded;
+}
+
+inline const Ledger::Entry* Ledger::find(const std::string& target) const
+{
+	auto it = m_Entries.find(target);
+	return it == m_Entries.end() ? nullptr : &it->second;
+}
+
+inline void Ledger::record(const std::string& target, const Entry& entry)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Fresh.emplace_back(target, entry);
+}
+
+inline Pantry::Pantry(std::filesystem::path directory, uint64_t capacity)
+	: m_Directory(std::move(directory)), m_Capacity(capacity)
+{
+	std::filesystem::create_directories(m_Directory);
+}
+
+inline std::filesystem::path Pantry::shelf(uint64_t key) const
+{
+	char name[17];
+	std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+	return m_Directory / std::string(name, 2) / std::string(name + 2);
+}
+
+// With `exact` set when the key stands for precisely what a compile would
+// read. A key from a depfile only does once that depfile was written by the
+// very compile being keyed: the previous one may miss headers this one reads.
+inline std::optional<uint64_t> Pantry::key(const Recipe* recipe, uint64_t command, bool* exact)
+{
+	if (exact != nullptr) *exact = false;
+	auto target = recipe->target();
+	auto depfile = recipe->depfile();
+	if (target.empty() || depfile.empty()) return std::nullopt;
+
+	std::unordered_map<std::string, const Recipe*> makers;
+	for (const Recipe* maker : recipe->made_inputs())
+		makers.emplace(std::filesystem::path(maker->target()).lexically_normal().string(), maker);
+
+	uint64_t key = Sink::hash(std::string_view(reinterpret_cast<const char*>(&command), sizeof(command)));
+	auto mix = [&](std::string_view path) {
+		auto maker = makers.find(std::filesystem::path(path).lexically_normal().string());
+		auto hashed = maker != makers.end() ? provenance(maker->second) : m_Digests.of(std::string(path));
+		if (!hashed.has_value()) return false;
+		key = Sink::hash(std::string_view(reinterpret_cast<const char*>(&*hashed), sizeof(*hashed)),
+						 Sink::hash(path, key));
+		return true;
+	};
+
+	for (const auto& input : recipe->inputs())
+		if (!mix(input)) return std::nullopt;
+
+	Sink::Depfile deps;
+	if (deps.load(depfile)) {
+		key = Sink::hash("depfile", key);
+		for (const auto& input : deps.inputs())
+			if (!mix(input)) return std::nullopt;
+		return key;
+	}
+
+	std::string preprocessed = target + ".i";
+	auto command_line = recipe->preprocess_command(preprocessed);
+	if (command_line.empty() || Sink::start_job_sync(command_line, true).m_Status != 0) return std::nullopt;
+
+	auto hashed = Sink::hash_file(preprocessed, Sink::hash("preprocessed", key));
+	std::error_code ec;
+	std::filesystem::remove(preprocessed, ec);
+	if (exact != nullptr) *exact = hashed.has_value();
+	return hashed;
+}
+
+// Stands in for the bytes of an input that differ from build to build: the
+// command that made it and the contents of everything that command read.
+inline std::optional<uint64_t> Pantry::provenance(const Recipe* maker)
+{
+	uint64_t key = Sink::hash_command(maker->get_command());
+	auto mix = [&](std::string_view path) {
+		auto hashed = m_Digests.of(std::string(path));
+		if (!hashed.has_value()) return false;
+		key = Sink::hash(std::string_view(reinterpret_cast<const char*>(&*hashed), sizeof(*hashed)),
+						 Sink::hash(path, key));
+		return true;
+	};
+
+	for (const auto& input : maker->inputs())
+		if (!mix(input)) return std::nullopt;
+	Sink::Depfile deps;
+	if (!maker->depfile().empty() && deps.load(maker->depfile()))
+		for (const auto& input : deps.inputs())
+			if (!mix(input)) return std::nullopt;
+	return key;
+}
+
+inline bool Pantry::restore(const std::filesystem::path& from, const std::filesystem::path& to)
+{
+	std::error_code ec;
+	std::filesystem::remove(to, ec);
+
+#ifdef FICLONE
+	int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+	if (in >= 0) {
+		int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		bool cloned = out >= 0 && ::ioctl(out, FICLONE, in) == 0;
+		if (out >= 0) ::close(out);
+		::close(in);
+		if (cloned) return true;
+		std::filesystem::remove(to, ec);
+	}
+#endif // FICLONE
+
+	ec.clear();
+	std::filesystem::create_hard_link(from, to, ec);
+	if (!ec) return true;
+	return std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+}
+
+inline bool Pantry::fetch(uint64_t key, const Recipe* recipe)
+{
+	auto shelf = this->shelf(key);
+	std::filesystem::path output = shelf;
+	output += ".out";
+	std::filesystem::path depfile = shelf;
+	depfile += ".d";
+
+	std::error_code ec;
+	if (!std::filesystem::exists(output, ec) || !restore(output, recipe->target())) return false;
+	if (std::filesystem::exists(depfile, ec)) restore(depfile, recipe->depfile());
+
+	// Restored outputs must look newer than their inputs, and the shelf's mtime
+	// doubles as its last use for eviction.
+	auto now = std::filesystem::file_time_type::clock::now();
+	std::filesystem::last_write_time(recipe->target(), now, ec);
+	std::filesystem::last_write_time(output, now, ec);
+	std::filesystem::last_write_time(depfile, now, ec);
+	++m_Hits;
+	return true;
+}
+
+inline void Pantry::store(uint64_t key, const Recipe* recipe)
+{
+	auto shelf = this->shelf(key);
+	std::error_code ec;
+	std::filesystem::create_directories(shelf.parent_path(), ec);
+
+	// Copy under a temporary name first so a concurrent reader never sees half
+	// an entry.
+	auto stock = [&](const std::filesystem::path& from, const char* extension) {
+		std::filesystem::path to = shelf;
+		to += extension;
+		std::filesystem::path partial = to;
+		partial += ".tmp";
+		if (!std::filesystem::copy_file(from, partial, std::filesystem::copy_options::overwrite_existing, ec))
+			return;
+		std::filesystem::rename(partial, to, ec);
+		if (!ec) m_Stored += std::filesystem::file_size(to, ec);
+	};
+
+	stock(recipe->depfile(), ".d");
+	stock(recipe->target(), ".out");
+}
+
+inline void Pantry::miss()
+{
+	++m_Misses;
+}
+
+inline void Pantry::evict()
+{
+	std::vector<std::tuple<std::filesystem::file_time_type, uint64_t, std::filesystem::path>> shelves;
+	uint64_t total = 0;
+	std::error_code ec;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(m_Directory, ec)) {
+		if (!entry.is_regular_file(ec) || entry.path().parent_path() == m_Directory) continue;
+		uint64_t size = entry.file_size(ec);
+		shelves.emplace_back(entry.last_write_time(ec), size, entry.path());
+		total += size;
+	}
+
+	std::sort(shelves.begin(), shelves.end());
+	uint64_t goal = m_Capacity / 10 * 9;
+	for (const auto& [time, size, path] : shelves) {
+		if (total <= goal) break;
+		if (std::filesystem::remove(path, ec)) total -= size;
+	}
+	m_Stored = total;
+}
+
+// Folds this run's counters into the on-disk statistics and evicts when the
+// pantry has grown past its capacity.
+inline void Pantry::close()
+{
+	uint64_t hits = 0, misses = 0, size = 0;
+	std::filesystem::path path = m_Directory / "stats";
+	if (FILE* file = std::fopen(path.c_str(), "r")) {
+		unsigned long long h, m, z;
+		if (std::fscanf(file, "hits %llu misses %llu size %llu", &h, &m, &z) == 3) hits = h, misses = m, size = z;
+		std::fclose(file);
+	}
+
+	uint64_t looked_up = m_Hits + m_Misses;
+	hits += m_Hits.exchange(0);
+	misses += m_Misses.exchange(0);
+	size += m_Stored.exchange(0);
+	if (size > m_Capacity) {
+		evict();
+		size = m_Stored.exchange(0);
+	}
+
+	if (FILE* file = std::fopen(path.c_str(), "w")) {
+		std::fprintf(file, "hits %llu misses %llu size %llu\n", static_cast<unsigned long long>(hits),
+					 static_cast<unsigned long long>(misses), static_cast<unsigned long long>(size));
+		std::fclose(file);
+	}
+
+	if (looked_up == 0) return;
+	uint64_t lookups = hits + misses;
+	std::stringstream ss;
+	ss << "pantry: " << hits << " hits, " << misses << " misses";
+	if (lookups > 0) ss << " (" << hits * 100 / lookups << "% hit rate)";
+	ss << ", " << (size >> 20) << " of " << (m_Capacity >> 20) << " MiB used";
+	Sink::log(Sink::LogLevel::INFO, ss.str());
+}
+
+inline int64_t Timeline::now() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_Epoch).count();
+}
+
+inline void Timeline::record(Event event)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Events.push_back(std::move(event));
+}
+
+inline void Timeline::clear()
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Events.clear();
+	m_Epoch = std::chrono::steady_clock::now();
+}
+
+inline const std::vector<Timeline::Event>& Timeline::events() const
+{
+	return m_Events;
+}
+
+inline bool Timeline::write(const std::string& path) const
+{
+	auto quote = [](const std::string& text) {
+		std::string quoted = "\"";
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				quoted += '\\';
+				quoted += c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				quoted += escaped;
+			} else {
+				quoted += c;
+			}
+		}
+		return quoted + "\"";
+	};
 
-	for (auto& input_file_str : m_Files->get_ingredients()) {
-		std::filesystem::path input_file = input_file_str;
-		auto in_file_mod_time = std::filesystem::last_write_time(input_file);
-		if (!std::filesystem::exists(output) || std::filesystem::last_write_time(output) < in_file_mod_time) {
-			should_rebuild = true;
-			break;
+	std::stringstream json;
+	json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (size_t i = 0; i < m_Events.size(); ++i) {
+		const auto& event = m_Events[i];
+		json << (i == 0 ? "\n" : ",\n") << "{\"name\":" << quote(event.m_Name) << ",\"cat\":\""
+			 << (event.m_Cached ? "cached" : "job") << "\",\"ph\":\"X\",\"ts\":" << event.m_Start
+			 << ",\"dur\":" << event.m_End - event.m_Start << ",\"pid\":" << ::getpid()
+			 << ",\"tid\":" << event.m_Station << ",\"args\":{\"status\":" << event.m_Status << "}}";
+	}
+	json << "\n]}\n";
+
+	FILE* file = std::fopen(path.c_str(), "w");
+	if (file == nullptr) return false;
+	auto text = json.str();
+	bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+	return std::fclose(file) == 0 && written;
+}
+
+inline Countertop::Countertop(uint64_t budget) : m_Budget(budget) {}
+
+inline void Countertop::claim(uint64_t bytes)
+{
+	std::unique_lock<std::mutex> lock(m_Lock);
+	auto fits = [&]() { return m_Used == 0 || m_Used + bytes <= m_Budget; };
+	if (!fits()) {
+		m_Held = true;
+		m_Freed.wait(lock, fits);
+	}
+	m_Used += bytes;
+	m_Widest = std::max(m_Widest, ++m_Jobs);
+}
+
+inline void Countertop::clear(uint64_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Used -= bytes;
+		--m_Jobs;
+	}
+	m_Freed.notify_all();
+}
+
+inline uint64_t Countertop::budget() const
+{
+	return m_Budget;
+}
+
+// The most jobs that ran at once, if the budget ever held one back; else 0.
+inline size_t Countertop::held()
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return m_Held ? m_Widest : 0;
+}
+
+// MemAvailable, capped by the headroom left under our cgroup's memory limit.
+inline uint64_t Countertop::available()
+{
+	uint64_t result = UINT64_MAX;
+	char line[512];
+	if (FILE* file = std::fopen("/proc/meminfo", "r")) {
+		unsigned long long kib;
+		while (std::fgets(line, sizeof(line), file))
+			if (std::sscanf(line, "MemAvailable: %llu kB", &kib) == 1) result = uint64_t(kib) << 10;
+		std::fclose(file);
+	}
+
+	auto read = [](const std::string& path) -> std::optional<uint64_t> {
+		FILE* file = std::fopen(path.c_str(), "r");
+		if (file == nullptr) return std::nullopt;
+		unsigned long long value;
+		bool parsed = std::fscanf(file, "%llu", &value) == 1;
+		std::fclose(file);
+		return parsed ? std::optional<uint64_t>(value) : std::nullopt;
+	};
+
+	// cgroup v2 lists the unified hierarchy as "0::<path>" and v1 the memory
+	// controller as "<id>:...memory...:<path>". Hybrid hosts list both, and
+	// only one of them may actually limit memory.
+	std::string unified, legacy;
+	bool v1 = false;
+	if (FILE* file = std::fopen("/proc/self/cgroup", "r")) {
+		while (std::fgets(line, sizeof(line), file)) {
+			std::string_view entry(line);
+			while (!entry.empty() && (entry.back() == '\n' || entry.back() == '/'))
+				entry.remove_suffix(1);
+			auto first = entry.find(':');
+			auto second = first == std::string_view::npos ? first : entry.find(':', first + 1);
+			if (second == std::string_view::npos) continue;
+			std::string controllers(",");
+			controllers.append(entry.substr(first + 1, second - first - 1)).append(",");
+			if (controllers == ",,") unified = entry.substr(second + 1);
+			if (controllers.find(",memory,") != std::string::npos) {
+				legacy = entry.substr(second + 1);
+				v1 = true;
+			}
+		}
+		std::fclose(file);
+	}
+
+	// Where the v1 memory hierarchy is mounted, and which of its groups is
+	// the root of that mount.
+	std::string mount = "/sys/fs/cgroup/memory", root = "/";
+	if (FILE* file = v1 ? std::fopen("/proc/self/mountinfo", "r") : nullptr) {
+		while (std::fgets(line, sizeof(line), file)) {
+			std::stringstream fields(line);
+			std::string id, parent, device, base, point, field;
+			fields >> id >> parent >> device >> base >> point;
+			while (fields >> field && field != "-") {}
+			std::string type, source, options;
+			fields >> type >> source >> options;
+			if (type == "cgroup" && ("," + options + ",").find(",memory,") != std::string::npos) {
+				mount = point;
+				root = base;
+			}
+		}
+		std::fclose(file);
+	}
+	if (root != "/" && legacy.rfind(root, 0) == 0) legacy.erase(0, root.size());
+
+	auto headroom = [&](const std::string& directory, const char* limit_file, const char* usage_file) {
+		auto limit = read(directory + limit_file);
+		auto usage = read(directory + usage_file);
+		if (!limit.has_value() || !usage.has_value()) return false;
+		result = std::min(result, *limit > *usage ? *limit - *usage : 0);
+		return true;
+	};
+	// memory.max holds "max" when unlimited, which does not parse.
+	if (headroom("/sys/fs/cgroup" + unified, "/memory.max", "/memory.current") || !v1) return result;
+	if (!headroom(mount + legacy, "/memory.limit_in_bytes", "/memory.usage_in_bytes"))
+		headroom(mount, "/memory.limit_in_bytes", "/memory.usage_in_bytes");
+	return result;
+}
+
+inline Sink::JobResult LocalExecutor::run(const Recipe*, const std::vector<std::string>& command, bool capture)
+{
+	return Sink::start_job_sync(command, capture);
+}
+
+inline RemoteExecutor::RemoteExecutor(const std::vector<std::string>& sockets)
+{
+	for (const auto& socket : sockets)
+		m_Workers.emplace_back().m_Socket = socket;
+}
+
+// Relative paths of everything the job reads, or nothing when that cannot be
+// told or some input would not land in the same place under the worker's
+// scratch directory.
+inline std::optional<std::vector<std::string>> RemoteExecutor::manifest(const Recipe* recipe)
+{
+	auto depfile = recipe->depfile();
+	if (depfile.empty() || !recipe->self_contained()) return std::nullopt;
+
+	// The previous depfile misses any include added since, so always ask.
+	auto scan = recipe->preprocess_command("/dev/null");
+	if (scan.empty()) return std::nullopt;
+	auto listing = depfile + ".scan";
+	scan.insert(scan.end(), {"-MD", "-MF", listing});
+	Sink::Depfile deps;
+	bool scanned = Sink::start_job_sync(scan, true).m_Status == 0 && deps.load(listing);
+	std::error_code ec;
+	std::filesystem::remove(listing, ec);
+	if (!scanned) return std::nullopt;
+
+	std::vector<std::string> inputs = recipe->inputs();
+	inputs.insert(inputs.end(), deps.inputs().begin(), deps.inputs().end());
+	std::vector<std::string> manifest;
+	std::unordered_set<std::string> seen;
+	for (const auto& input : inputs) {
+		auto path = std::filesystem::path(input).lexically_normal();
+		if (path.is_absolute()) continue;
+		if (path.empty() || *path.begin() == "..") return std::nullopt;
+		if (seen.insert(path.string()).second) manifest.push_back(path.string());
+	}
+	return manifest;
+}
+
+// Least busy worker still reachable, taking turns among equally busy ones.
+inline RemoteExecutor::Worker* RemoteExecutor::pick()
+{
+	Worker* best = nullptr;
+	size_t start = m_Next++;
+	for (size_t i = 0; i < m_Workers.size(); ++i) {
+		auto& worker = m_Workers[(start + i) % m_Workers.size()];
+		if (!worker.m_Down && (best == nullptr || worker.m_Running < best->m_Running)) best = &worker;
+	}
+	return best;
+}
+
+// One connection per job: the job with the digest of every input, the
+// digests the worker lacks, one parcel per missing input, and finally the
+// result with the outputs. Nothing comes back when the worker could not be
+// talked to, so the job can still run here.
+inline std::optional<Sink::JobResult> RemoteExecutor::send(Worker& worker, const Recipe* recipe,
+														   const std::vector<std::string>& command,
+														   const std::vector<std::string>& inputs)
+{
+	Sink::Parcel job;
+	job.put("job").put(command.size());
+	for (const auto& argument : command)
+		job.put(argument);
+
+	std::unordered_map<std::string, std::string> paths;
+	job.put(inputs.size());
+	for (const auto& input : inputs) {
+		auto digest = m_Digests.of(input);
+		if (!digest.has_value()) return std::nullopt;
+		job.put(input).put(Sink::hex(*digest));
+		paths.emplace(Sink::hex(*digest), input);
+	}
+	std::vector<std::string> outputs = {recipe->target(), recipe->depfile()};
+	job.put(outputs.size());
+	for (const auto& output : outputs)
+		job.put(output);
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	int fd = Sink::open_socket();
+	bool connected = fd >= 0 && worker.m_Socket.size() < sizeof(address.sun_path);
+	if (connected) {
+		std::memcpy(address.sun_path, worker.m_Socket.c_str(), worker.m_Socket.size() + 1);
+		connected = ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+	}
+	auto hang_up = [&](const std::string& problem) -> std::optional<Sink::JobResult> {
+		if (fd >= 0) ::close(fd);
+		worker.m_Down = true;
+		Sink::log(Sink::LogLevel::WARN, problem + ", no more jobs go to " + worker.m_Socket);
+		return std::nullopt;
+	};
+	if (!connected) return hang_up("could not reach worker " + worker.m_Socket);
+
+	auto need = job.send(fd) ? Sink::Parcel::receive(fd) : std::nullopt;
+	size_t missing = need.has_value() ? need->count() : 0;
+	for (size_t i = 0; i < missing && need->good(); ++i) {
+		auto digest = need->take();
+		auto it = paths.find(digest);
+		auto contents = it != paths.end() ? Sink::read_file(it->second) : std::nullopt;
+		if (!contents.has_value() || !Sink::Parcel().put(digest).put(*contents).send(fd)) need.reset();
+	}
+	if (!need.has_value() || !need->good()) return hang_up("could not upload inputs");
+
+	// Closing the connection is how a cancelled build stops the remote job.
+	pollfd ready = {fd, POLLIN, 0};
+	while (::poll(&ready, 1, 100) <= 0) {
+		if (!Sink::Burners::shared().cancelled()) continue;
+		::close(fd);
+		return Sink::JobResult{128 + SIGTERM, {}, {}, 0};
+	}
+
+	auto done = Sink::Parcel::receive(fd);
+	if (!done.has_value()) return hang_up("lost the worker while it ran " + recipe->target());
+	Sink::JobResult result;
+	result.m_Status = int(done->number());
+	result.m_Output = done->take();
+	result.m_Errors = done->take();
+	result.m_PeakRss = done->number();
+	// Only the outputs asked for may be written back, each at most once.
+	std::vector<std::tuple<std::string, bool, std::string>> returned(done->count(3));
+	auto expected = outputs;
+	for (auto& [path, present, contents] : returned) {
+		path = done->take();
+		present = done->number() != 0;
+		contents = done->take();
+		auto it = std::find(expected.begin(), expected.end(), path);
+		if (!done->good()) break;
+		if (it == expected.end()) {
+			hang_up("worker returned unrequested output " + path);
+			return Sink::JobResult{1, {}, "worker returned unrequested output " + path + "\n", 0};
 		}
+		expected.erase(it);
+	}
+	if (!done->good()) return hang_up("garbled result");
+	::close(fd);
+
+	for (const auto& [path, present, contents] : returned) {
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+		if (!present || path.empty()) continue;
+
+		std::filesystem::path partial = path + ".remote";
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+		if (Sink::write_file(partial, contents)) std::filesystem::rename(partial, path, ec);
+	}
+	return result;
+}
+
+inline Sink::JobResult RemoteExecutor::run(const Recipe* recipe, const std::vector<std::string>& command, bool capture)
+{
+	auto inputs = manifest(recipe);
+	std::optional<Sink::JobResult> result;
+	while (inputs.has_value() && !result.has_value()) {
+		Worker* worker = pick();
+		if (worker == nullptr) break;
+		++worker->m_Running;
+		result = send(*worker, recipe, command, *inputs);
+		--worker->m_Running;
 	}
+	if (!result.has_value()) return m_Local.run(recipe, command, capture);
 
-	return should_rebuild;
+	if (!capture) {
+		std::cout << result->m_Output << std::flush;
+		std::cerr << result->m_Errors << std::flush;
+		result->m_Output.clear();
+		result->m_Errors.clear();
+	}
+	return *result;
 }
 
 inline LineCook& LineCook::learn_recipe(Recipe* recipe)
@@ -434,35 +4080,502 @@ inline void LineCook::dessert()
 	std::exit(cook());
 }
 
-inline int LineCook::cook()
+inline LineCook& LineCook::jobs(size_t count)
 {
-	std::vector<std::thread> threads;
-	std::atomic<int> error(0);
+	m_Jobs = std::max<size_t>(count, 1);
+	return *this;
+}
+
+inline LineCook& LineCook::ledger(const std::string& path)
+{
+	m_Ledger = path;
+	return *this;
+}
+
+inline LineCook& LineCook::pantry(const std::string& directory, uint64_t capacity)
+{
+	m_Pantry = directory;
+	m_PantryCapacity = capacity;
+	return *this;
+}
+
+inline LineCook& LineCook::trace(const std::string& path)
+{
+	m_Trace = path;
+	return *this;
+}
+
+inline LineCook& LineCook::summary(size_t slowest)
+{
+	m_Summary = slowest;
+	return *this;
+}
+
+inline LineCook& LineCook::watch(size_t debounce)
+{
+	m_Watch = debounce;
+	return *this;
+}
+
+// Stop after this many failed jobs, 0 meaning never. Independent work keeps
+// being scheduled until then and every failure is listed at the end.
+inline LineCook& LineCook::keep_going(size_t failures)
+{
+	m_KeepGoing = failures;
+	return *this;
+}
+
+// Jobs the build log has no peak for are assumed to need `estimate` bytes. By
+// default that is nothing, so only jobs with a recorded peak are held back.
+// A zero budget means whatever the machine and our cgroup have available when
+// the build starts.
+inline LineCook& LineCook::memory(uint64_t estimate, uint64_t budget)
+{
+	m_Estimate = estimate;
+	m_Budget = budget;
+	return *this;
+}
+
+inline LineCook& LineCook::executor(std::shared_ptr<Executor> executor)
+{
+	m_Executor = std::move(executor);
+	return *this;
+}
+
+// Spreads jobs over the flavortown-worker daemons listening on `sockets`.
+inline LineCook& LineCook::remote(const std::vector<std::string>& sockets)
+{
+	return executor(std::make_shared<RemoteExecutor>(sockets));
+}
+
+inline LineCook& LineCook::args(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (arg == "--watch") watch();
+		if (arg == "--remote" && i + 1 < argc) {
+			std::vector<std::string> sockets;
+			std::stringstream list(argv[++i]);
+			for (std::string socket; std::getline(list, socket, ',');)
+				if (!socket.empty()) sockets.push_back(socket);
+			remote(sockets);
+		}
+		if (arg.rfind("-j", 0) != 0 && arg.rfind("-k", 0) != 0) continue;
+
+		std::string value(arg.substr(2));
+		if (value.empty() && i + 1 < argc) value = argv[++i];
+		bool numeric = !value.empty() && value.find_first_not_of("0123456789") == std::string::npos;
+		if (!numeric)
+			Sink::log(Sink::LogLevel::WARN, "ignoring malformed option: " + std::string(arg) + " " + value);
+		else if (arg[1] == 'j')
+			jobs(std::stoul(value));
+		else
+			keep_going(std::stoul(value));
+	}
+	return *this;
+}
+
+// Learned recipes plus everything they transitively depend on, each once and
+// paired with its dependencies, including the ones it preps for itself.
+inline std::vector<std::pair<Recipe*, std::vector<Recipe*>>> LineCook::menu() const
+{
+	std::vector<std::pair<Recipe*, std::vector<Recipe*>>> recipes;
+	std::unordered_set<Recipe*> seen;
+	std::vector<Recipe*> stack(m_Recipes.rbegin(), m_Recipes.rend());
+
+	while (!stack.empty()) {
+		Recipe* recipe = stack.back();
+		stack.pop_back();
+		if (!seen.insert(recipe).second) continue;
+
+		std::vector<Recipe*> dependencies = recipe->dependencies();
+		for (Recipe* prepped : recipe->prep())
+			dependencies.push_back(prepped);
+		for (auto it = dependencies.rbegin(); it != dependencies.rend(); ++it)
+			stack.push_back(*it);
+		recipes.emplace_back(recipe, std::move(dependencies));
+	}
+	return recipes;
+}
+
+// Wires up dependents, rejects cycles and ranks every order by the cost of the
+// longest chain of work still hanging off it.
+inline bool LineCook::plan(std::vector<Order>& orders)
+{
+	std::unordered_map<Recipe*, size_t> index;
+	for (size_t i = 0; i < orders.size(); ++i)
+		index[orders[i].m_Recipe] = i;
+
+	for (size_t i = 0; i < orders.size(); ++i)
+		for (Recipe* dependency : orders[i].m_Dependencies)
+			orders[index.at(dependency)].m_Dependents.push_back(i);
+
+	enum class Mark { NONE, ACTIVE, DONE };
+	std::vector<Mark> marks(orders.size(), Mark::NONE);
+	std::vector<size_t> finished;
+	std::vector<size_t> path;
+
+	std::function<bool(size_t)> visit = [&](size_t i) {
+		if (marks[i] == Mark::DONE) return true;
+		if (marks[i] == Mark::ACTIVE) {
+			Sink::log(Sink::LogLevel::ERROR, "dependency cycle between recipes:");
+			auto start = std::find(path.begin(), path.end(), i);
+			for (auto it = start; it != path.end(); ++it)
+				Sink::print_command(orders[*it].m_Recipe->get_command());
+			return false;
+		}
+
+		marks[i] = Mark::ACTIVE;
+		path.push_back(i);
+		for (size_t dependent : orders[i].m_Dependents)
+			if (!visit(dependent)) return false;
+		path.pop_back();
+		marks[i] = Mark::DONE;
+		finished.push_back(i);
+		return true;
+	};
+
+	for (size_t i = 0; i < orders.size(); ++i)
+		if (!visit(i)) return false;
 
-	for (auto& recipe : m_Recipes) {
-		if (recipe->rebuild_needed()) {
-			auto command = recipe->get_command();
-			threads.push_back(std::thread([command, &error]() {
-				if (error.load() != 0) return;
+	// Dependents finish before the orders they hang off.
+	for (size_t i : finished) {
+		size_t longest = 0;
+		for (size_t dependent : orders[i].m_Dependents)
+			longest = std::max(longest, orders[dependent].m_Priority);
+		orders[i].m_Priority = longest + orders[i].m_Cost;
+	}
+	return true;
+}
+
+// Cooks every selected order once all of its selected dependencies are done.
+// Orders outside the selection are taken as they are. Once the failure limit
+// is reached nothing new starts and the jobs still running are cancelled.
+inline int LineCook::serve(std::vector<Order>& orders, const std::vector<bool>& selected, Shift& shift,
+						   Brigade& brigade) const
+{
+	for (auto& order : orders) {
+		order.m_Waiting = 0;
+		order.m_Forced = false;
+		order.m_Restat = false;
+	}
+	for (size_t i = 0; i < orders.size(); ++i)
+		if (selected[i])
+			for (size_t dependent : orders[i].m_Dependents)
+				++orders[dependent].m_Waiting;
+
+	// Staleness of everything selected is checked up front and side by side,
+	// so the stat cache is warm before the first job starts. An order only
+	// needs a second look if one of its dependencies gets rebuilt.
+	std::atomic<size_t> next(0);
+	for (size_t worker = 0; worker < brigade.size(); ++worker) {
+		brigade.submit([&]() {
+			for (size_t i = next++; i < orders.size(); i = next++) {
+				if (!selected[i]) continue;
+				const Recipe* recipe = orders[i].m_Recipe;
+				orders[i].m_Stale = stale(recipe, shift.m_Ledger, Sink::hash_command(recipe->get_command()));
+			}
+		});
+	}
+	brigade.wait();
+
+	auto& burners = Sink::Burners::shared();
+	burners.reset();
+	std::atomic<int> error(0);
+	std::atomic<bool> stopped(false);
+	std::atomic<size_t> served(0);
+	std::vector<std::pair<std::string, int>> failures;
+	std::mutex lock;
 
-				int status = 0;
-				Kitchen::Sink::print_command(command);
-				status = Kitchen::Sink::start_job_sync(command);
+	std::function<void(size_t)> fire = [&](size_t i) {
+		brigade.submit(
+			[&, i]() {
+				if (stopped) return;
 
+				Outcome outcome;
+				int status = cook(orders[i], shift, i, outcome);
 				if (status != 0) {
+					std::unique_lock<std::mutex> guard(lock);
+					if (stopped) return;
+
 					std::stringstream msg;
-					msg << "Thread exited with error status: " << status << std::endl;
+					msg << "Job exited with error status: " << status << std::endl;
 					std::cerr << msg.str();
-					error.store(status);
+					auto target = orders[i].m_Recipe->target();
+					failures.emplace_back(target.empty() ? orders[i].m_Recipe->get_command()[0] : target, status);
+					int expected = 0;
+					error.compare_exchange_strong(expected, status);
+					if (m_KeepGoing == 0 || failures.size() < m_KeepGoing) return;
+
+					stopped = true;
+					guard.unlock();
+					burners.cancel();
+					return;
+				}
+				++served;
+
+				for (size_t dependent : orders[i].m_Dependents) {
+					if (outcome == Outcome::CHANGED) orders[dependent].m_Forced = true;
+					if (outcome == Outcome::RESTATED) orders[dependent].m_Restat = true;
+					if (selected[dependent] && --orders[dependent].m_Waiting == 0) fire(dependent);
+				}
+			},
+			orders[i].m_Priority);
+	};
+
+	std::vector<size_t> ready;
+	for (size_t i = 0; i < orders.size(); ++i)
+		if (selected[i] && orders[i].m_Waiting == 0) ready.push_back(i);
+	std::stable_sort(ready.begin(), ready.end(),
+					 [&](size_t a, size_t b) { return orders[a].m_Priority > orders[b].m_Priority; });
+	for (size_t i : ready)
+		fire(i);
+	brigade.wait();
+
+	if (m_KeepGoing != 1 && !failures.empty()) {
+		size_t total = std::count(selected.begin(), selected.end(), true);
+		Sink::log(Sink::LogLevel::ERROR, std::to_string(failures.size()) + " jobs failed, "
+											 + std::to_string(total - served - failures.size())
+											 + " not attempted:");
+		for (const auto& [name, status] : failures)
+			Sink::log(Sink::LogLevel::ERROR, "  " + name + " (status " + std::to_string(status) + ")");
+	}
+	return error.load();
+}
+
+inline void LineCook::wrap_up(const std::vector<Order>& orders, Shift& shift) const
+{
+	if (!shift.m_Ledger.save()) Sink::log(Sink::LogLevel::WARN, "could not write build log " + m_Ledger);
+	if (shift.m_Pantry.has_value()) shift.m_Pantry->close();
+	if (!m_Trace.empty() && !shift.m_Timeline.write(m_Trace))
+		Sink::log(Sink::LogLevel::WARN, "could not write trace " + m_Trace);
+	if (m_Summary > 0) report(orders, shift.m_Timeline);
+}
+
+// Keeps the planned graph resident and re-cooks whatever an edit affects. The
+// parent directory of every input and depfile-discovered header is watched,
+// since editors often save by renaming over the original file, and a burst of
+// events is folded into one round once it has been quiet for the debounce.
+inline int LineCook::simmer(std::vector<Order>& orders, Shift& shift, Brigade& brigade) const
+{
+#ifdef __linux__
+	int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		Sink::log(Sink::LogLevel::ERROR, "could not watch for changes: " + std::string(std::strerror(errno)));
+		return 1;
+	}
+
+	auto normal = [](const std::string& path) {
+		std::error_code ec;
+		auto absolute = std::filesystem::absolute(path, ec);
+		return (ec ? std::filesystem::path(path) : absolute).lexically_normal();
+	};
+
+	std::unordered_map<int, std::filesystem::path> directories;
+	std::unordered_map<std::string, std::vector<size_t>> readers;
+	std::unordered_map<std::string, std::unordered_set<std::string>> spellings;
+	std::unordered_set<std::string> targets;
+	auto subscribe = [&]() {
+		readers.clear();
+		spellings.clear();
+		targets.clear();
+		for (size_t i = 0; i < orders.size(); ++i) {
+			const Recipe* recipe = orders[i].m_Recipe;
+			auto target = recipe->target();
+			if (!target.empty()) targets.insert(normal(target).string());
+
+			std::vector<std::string> paths = recipe->inputs();
+			Sink::Depfile deps;
+			auto depfile = recipe->depfile();
+			if (!depfile.empty() && deps.load(depfile))
+				for (const auto& input : deps.inputs())
+					paths.emplace_back(input);
+
+			for (const auto& path : paths) {
+				auto file = normal(path);
+				auto& list = readers[file.string()];
+				if (list.empty() || list.back() != i) list.push_back(i);
+				spellings[file.string()].insert(path);
+
+				int wd = ::inotify_add_watch(fd, file.parent_path().c_str(),
+											 IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+				if (wd >= 0) directories[wd] = file.parent_path();
+			}
+		}
+	};
+	subscribe();
+	Sink::log(Sink::LogLevel::INFO, "watching " + std::to_string(readers.size()) + " files for changes");
+
+	alignas(inotify_event) char buffer[1 << 16];
+	while (true) {
+		std::vector<bool> selected(orders.size(), false);
+		std::vector<size_t> changed;
+		pollfd pfd{fd, POLLIN, 0};
+
+		// Block until something happens, then drain until it goes quiet.
+		int timeout = -1;
+		while (true) {
+			int ready = ::poll(&pfd, 1, timeout);
+			if (ready < 0 && errno == EINTR) continue;
+			if (ready < 0) {
+				Sink::log(Sink::LogLevel::ERROR, "lost the watch: " + std::string(std::strerror(errno)));
+				::close(fd);
+				return 1;
+			}
+			if (ready == 0) break;
+
+			ssize_t length;
+			while ((length = ::read(fd, buffer, sizeof(buffer))) > 0) {
+				for (char* it = buffer; it < buffer + length;) {
+					const auto* event = reinterpret_cast<const inotify_event*>(it);
+					it += sizeof(inotify_event) + event->len;
+
+					if (event->mask & IN_Q_OVERFLOW) {
+						Sink::StatCache::shared().clear();
+						for (size_t i = 0; i < orders.size(); ++i)
+							changed.push_back(i);
+						continue;
+					}
+					auto directory = directories.find(event->wd);
+					if (directory == directories.end() || event->len == 0) continue;
+
+					auto path = (directory->second / event->name).string();
+					if (targets.count(path) != 0) continue;
+					auto spelled = spellings.find(path);
+					if (spelled == spellings.end()) continue;
+					for (const auto& spelling : spelled->second)
+						Sink::StatCache::shared().forget(spelling);
+					auto found = readers.find(path);
+					if (found == readers.end()) continue;
+					changed.insert(changed.end(), found->second.begin(), found->second.end());
 				}
-			}));
+			}
+			if (!changed.empty()) timeout = int(*m_Watch);
 		}
+
+		// Everything downstream of a changed input may need to follow it.
+		while (!changed.empty()) {
+			size_t i = changed.back();
+			changed.pop_back();
+			if (selected[i]) continue;
+			selected[i] = true;
+			changed.insert(changed.end(), orders[i].m_Dependents.begin(), orders[i].m_Dependents.end());
+		}
+
+		// Editors and tools touch more than the events name, such as files
+		// written through paths we do not watch.
+		Sink::StatCache::shared().clear();
+		shift.m_Timeline.clear();
+		serve(orders, selected, shift, brigade);
+		wrap_up(orders, shift);
+		subscribe();
+	}
+#else
+	(void)orders, (void)shift, (void)brigade;
+	Sink::log(Sink::LogLevel::WARN, "watching for changes needs inotify, stopping after one build");
+	return 0;
+#endif // __linux__
+}
+
+// Slowest jobs, the chain of jobs that bounded the wall time and how many
+// jobs ran side by side on average.
+inline void LineCook::report(const std::vector<Order>& orders, const Timeline& timeline) const
+{
+	auto events = timeline.events();
+	if (events.empty()) return;
+
+	int64_t wall = 0, busy = 0;
+	std::vector<int64_t> took(orders.size(), 0);
+	for (const auto& event : events) {
+		wall = std::max(wall, event.m_End);
+		busy += event.m_End - event.m_Start;
+		took[event.m_Order] = event.m_End - event.m_Start;
 	}
 
-	for (auto& thread : threads)
-		thread.join();
+	auto seconds = [](int64_t micros) {
+		std::stringstream ss;
+		ss.precision(2);
+		ss << std::fixed << micros / 1e6 << " s";
+		return ss.str();
+	};
 
-	return error.load();
+	Sink::log(Sink::LogLevel::INFO, "====== SUMMARY ======");
+	std::stringstream ss;
+	ss.precision(2);
+	ss << events.size() << " jobs in " << seconds(wall) << ", parallelism " << std::fixed
+	   << (wall > 0 ? double(busy) / wall : 0.0) << "x";
+	Sink::log(Sink::LogLevel::INFO, ss.str());
+
+	std::sort(events.begin(), events.end(), [](const Timeline::Event& a, const Timeline::Event& b) {
+		return a.m_End - a.m_Start > b.m_End - b.m_Start;
+	});
+	for (size_t i = 0; i < std::min(m_Summary, events.size()); ++i)
+		Sink::log(Sink::LogLevel::INFO, "slow: " + seconds(events[i].m_End - events[i].m_Start) + " "
+											+ events[i].m_Name);
+
+	// Higher priority always means earlier in topological order.
+	std::vector<size_t> sequence(orders.size());
+	std::iota(sequence.begin(), sequence.end(), 0);
+	std::sort(sequence.begin(), sequence.end(),
+			  [&](size_t a, size_t b) { return orders[a].m_Priority > orders[b].m_Priority; });
+
+	std::vector<int64_t> reach(orders.size(), 0);
+	std::vector<size_t> previous(orders.size(), orders.size());
+	size_t last = sequence.front();
+	for (size_t i : sequence) {
+		int64_t done = reach[i] + took[i];
+		for (size_t dependent : orders[i].m_Dependents) {
+			if (done > reach[dependent]) {
+				reach[dependent] = done;
+				previous[dependent] = i;
+			}
+		}
+		if (done > reach[last] + took[last]) last = i;
+	}
+
+	std::vector<std::string> path;
+	for (size_t i = last; i < orders.size(); i = previous[i]) {
+		if (took[i] == 0) continue;
+		auto target = orders[i].m_Recipe->target();
+		path.push_back(target.empty() ? orders[i].m_Recipe->get_command()[0] : target);
+	}
+	std::string chain;
+	for (auto it = path.rbegin(); it != path.rend(); ++it)
+		chain += (chain.empty() ? "" : " -> ") + *it;
+	Sink::log(Sink::LogLevel::INFO, "critical path (" + seconds(reach[last] + took[last]) + "): " + chain);
+}
+
+inline int LineCook::cook()
+{
+	// Stamps from an earlier cook() in this process may be out of date.
+	Sink::StatCache::shared().clear();
+	Shift shift{Ledger(m_Ledger), std::nullopt, {}, false, std::nullopt, m_Estimate, m_Executor.get()};
+	auto& ledger = shift.m_Ledger;
+	ledger.load();
+	if (!m_Pantry.empty()) shift.m_Pantry.emplace(m_Pantry, m_PantryCapacity);
+	shift.m_Countertop.emplace(m_Budget > 0 ? m_Budget : Countertop::available());
+
+	auto recipes = menu();
+	std::vector<Order> orders(recipes.size());
+	for (size_t i = 0; i < recipes.size(); ++i) {
+		orders[i].m_Recipe = recipes[i].first;
+		orders[i].m_Dependencies = std::move(recipes[i].second);
+		if (auto entry = ledger.find(orders[i].m_Recipe->target()))
+			orders[i].m_Cost = std::max<size_t>(entry->m_Duration, 1);
+	}
+	if (!plan(orders)) return 1;
+
+	Brigade brigade(std::min(m_Jobs, std::max<size_t>(orders.size(), 1)));
+	shift.m_Live = brigade.size() == 1;
+
+	int status = serve(orders, std::vector<bool>(orders.size(), true), shift, brigade);
+	if (size_t widest = shift.m_Countertop->held(); widest < brigade.size() && widest > 0)
+		Sink::log(Sink::LogLevel::INFO, "memory budget of " + std::to_string(shift.m_Countertop->budget() >> 20)
+											+ " MiB held the build to " + std::to_string(widest) + " of "
+											+ std::to_string(brigade.size()) + " jobs at a time");
+	wrap_up(orders, shift);
+	if (m_Watch.has_value()) return simmer(orders, shift, brigade);
+	return status;
 }
 
 } // namespace Kitchen
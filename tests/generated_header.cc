@@ -0,0 +1,49 @@
+// Checks that objects wait for a code generator their CompilerRecipe depends on.
+//
+//   c++ -std=c++17 -pthread -o generated_header tests/generated_header.cc
+//   ./generated_header [-j N]
+//
+// Builds a scratch project whose source includes a header written by a slow
+// FunctionRecipe, then runs the result. Exits non-zero if any step fails.
+
+#include "../build.hh"
+
+#include <chrono>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char** argv)
+{
+	fs::path scratch = fs::temp_directory_path() / ("flavortown-generated-header-" + std::to_string(::getpid()));
+	fs::remove_all(scratch);
+	fs::create_directories(scratch / "src");
+	fs::current_path(scratch);
+	Kitchen::Sink::write_file("src/main.cc", "#include \"gen.h\"\nint main() { return ANSWER - 42; }\n");
+	Kitchen::Sink::write_file("src/other.cc", "#include \"gen.h\"\nint other() { return ANSWER; }\n");
+
+	Kitchen::FunctionRecipe gen("gen");
+	gen.output("gen/gen.h").body([]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		fs::create_directories("gen");
+		return Kitchen::Sink::write_file("gen/gen.h", "#define ANSWER 42\n") ? 0 : 1;
+	});
+
+	Kitchen::Ingredients files;
+	files += "src/main.cc";
+	files += "src/other.cc";
+	Kitchen::CompilerRecipe app("app");
+	app.compiler("c++").push({"-Igen"}).files(files).objects("obj").depends_on(&gen);
+	Kitchen::LinkerRecipe link;
+	link.compiler("c++").objects(&app).output("app");
+
+	Kitchen::LineCook cook;
+	cook.args(argc, argv);
+	cook += &link;
+	int status = cook.cook();
+	if (status == 0) status = Kitchen::Sink::start_job_sync(std::vector<std::string>{"./app"});
+
+	fs::current_path(scratch.parent_path());
+	fs::remove_all(scratch);
+	std::cerr << (status == 0 ? "ok" : "FAILED") << ": objects wait for a generated header\n";
+	return status == 0 ? 0 : 1;
+}
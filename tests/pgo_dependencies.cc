@@ -0,0 +1,54 @@
+// Checks that every stage of a PgoRecipe waits for what the recipe depends on.
+//
+//   c++ -std=c++17 -pthread -o pgo_dependencies tests/pgo_dependencies.cc
+//   ./pgo_dependencies [-j N]
+//
+// Builds a scratch program whose source includes a header written by a slow
+// FunctionRecipe, trains it and runs the optimized result. Needs clang++ and
+// llvm-profdata on the PATH, and skips without them. Exits non-zero if any
+// step fails.
+
+#include "../build.hh"
+
+#include <chrono>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char** argv)
+{
+	for (const char* tool : {"clang++", "llvm-profdata"}) {
+		if (Kitchen::Sink::start_job_sync({tool, "--help"}, true).m_Status == 0) continue;
+		std::cerr << "skipped: " << tool << " not found\n";
+		return 0;
+	}
+
+	fs::path scratch = fs::temp_directory_path() / ("flavortown-pgo-dependencies-" + std::to_string(::getpid()));
+	fs::remove_all(scratch);
+	fs::create_directories(scratch / "src");
+	fs::current_path(scratch);
+	Kitchen::Sink::write_file("src/main.cc", "#include \"gen.h\"\n"
+											 "int main(int argc, char**) { return argc > 1 ? 0 : ANSWER - 42; }\n");
+
+	Kitchen::FunctionRecipe gen("gen");
+	gen.output("gen/gen.h").body([]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		fs::create_directories("gen");
+		return Kitchen::Sink::write_file("gen/gen.h", "#define ANSWER 42\n") ? 0 : 1;
+	});
+
+	Kitchen::Ingredients files;
+	files += "src/main.cc";
+	Kitchen::PgoRecipe app;
+	app.compiler("clang++").push({"-Igen", "-O2"}).files(files).output("app").train({"training"}).depends_on(&gen);
+
+	Kitchen::LineCook cook;
+	cook.args(argc, argv);
+	cook += &app;
+	int status = cook.cook();
+	if (status == 0) status = Kitchen::Sink::start_job_sync(std::vector<std::string>{"./app"});
+
+	fs::current_path(scratch.parent_path());
+	fs::remove_all(scratch);
+	std::cerr << (status == 0 ? "ok" : "FAILED") << ": PGO stages wait for a generated header\n";
+	return status == 0 ? 0 : 1;
+}
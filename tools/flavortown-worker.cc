@@ -0,0 +1,191 @@
+// Runs jobs sent by LineCook's RemoteExecutor.
+//
+//   c++ -std=c++17 -O2 -pthread -o flavortown-worker tools/flavortown-worker.cc
+//   ./flavortown-worker <socket> [store=.flavortown-worker]
+//
+// Inputs are kept by digest under <store>/blobs, read-only and shared by every
+// job. Each connection is served by a process of its own that lays its inputs
+// out in a scratch directory under <store>/jobs, runs the job there and sends
+// back its outputs. A client that hangs up cancels its job.
+
+#include "../build.hh"
+
+namespace {
+
+namespace fs = std::filesystem;
+using Kitchen::Sink::Parcel;
+
+bool relative(const fs::path& path)
+{
+	auto normal = path.lexically_normal();
+	return !normal.empty() && !normal.is_absolute() && *normal.begin() != "..";
+}
+
+// Stores one uploaded input under its digest, unless its contents disagree.
+bool shelve(const fs::path& blobs, const std::string& digest, const std::string& contents)
+{
+	auto blob = blobs / digest;
+	auto partial = blobs / (digest + "." + std::to_string(::getpid()));
+	if (!Kitchen::Sink::write_file(partial, contents)) return false;
+	auto hashed = Kitchen::Sink::hash_file(partial.string(), Kitchen::Sink::hash({}));
+	std::error_code ec;
+	if (!hashed.has_value() || Kitchen::Sink::hex(*hashed) != digest) {
+		fs::remove(partial, ec);
+		return false;
+	}
+	fs::permissions(partial, fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read, ec);
+	fs::rename(partial, blob, ec);
+	return !ec;
+}
+
+bool lay_out(const fs::path& blob, const fs::path& path)
+{
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+	fs::create_hard_link(blob, path, ec);
+	if (ec) fs::copy_file(blob, path, ec);
+	return !ec;
+}
+
+// Runs the job while watching the connection, so a client that gives up
+// takes the job down with it.
+Kitchen::Sink::JobResult run(int fd, const std::vector<std::string>& command)
+{
+	std::atomic<bool> done(false);
+	std::thread watcher([&]() {
+		pollfd connection = {fd, POLLIN, 0};
+		while (!done) {
+			if (::poll(&connection, 1, 100) <= 0) continue;
+			char byte;
+			if (::recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0) continue;
+			Kitchen::Sink::Burners::shared().cancel();
+			break;
+		}
+	});
+	auto result = Kitchen::Sink::start_job_sync(command, true);
+	done = true;
+	watcher.join();
+	return result;
+}
+
+int serve(int fd, const fs::path& store)
+{
+	auto job = Parcel::receive(fd);
+	if (!job.has_value() || job->take() != "job") return 1;
+
+	std::vector<std::string> command(job->count());
+	for (auto& argument : command)
+		argument = job->take();
+	std::vector<std::pair<std::string, std::string>> inputs(job->count(2));
+	for (auto& [path, digest] : inputs) {
+		path = job->take();
+		digest = job->take();
+	}
+	std::vector<std::string> outputs(job->count());
+	for (auto& output : outputs)
+		output = job->take();
+
+	bool valid = job->good() && !command.empty();
+	for (const auto& [path, digest] : inputs)
+		valid = valid && relative(path) && digest.size() == 16;
+	for (const auto& output : outputs)
+		valid = valid && (output.empty() || relative(output));
+	if (!valid) return 1;
+
+	auto blobs = store / "blobs";
+	std::vector<std::string> missing;
+	for (const auto& [path, digest] : inputs)
+		if (!fs::exists(blobs / digest) && std::find(missing.begin(), missing.end(), digest) == missing.end())
+			missing.push_back(digest);
+	Parcel need;
+	need.put(missing.size());
+	for (const auto& digest : missing)
+		need.put(digest);
+	if (!need.send(fd)) return 1;
+
+	for (size_t i = 0; i < missing.size(); ++i) {
+		auto blob = Parcel::receive(fd);
+		if (!blob.has_value()) return 1;
+		auto digest = blob->take();
+		auto contents = blob->take();
+		if (!blob->good() || std::find(missing.begin(), missing.end(), digest) == missing.end()) return 1;
+		if (!shelve(blobs, digest, contents)) {
+			Kitchen::Sink::log(Kitchen::Sink::LogLevel::WARN, "upload does not match its digest " + digest);
+			return 1;
+		}
+	}
+
+	auto scratch = store / "jobs" / std::to_string(::getpid());
+	std::error_code ec;
+	fs::remove_all(scratch, ec);
+	Kitchen::Sink::JobResult result;
+	for (const auto& [path, digest] : inputs)
+		if (!lay_out(blobs / digest, scratch / path)) result = {1, {}, "worker could not lay out " + path + "\n", 0};
+	for (const auto& output : outputs)
+		if (!output.empty()) fs::create_directories((scratch / output).parent_path(), ec);
+
+	if (result.m_Status == 0) {
+		fs::current_path(scratch, ec);
+		result = ec ? Kitchen::Sink::JobResult{1, {}, "worker could not enter " + scratch.string() + "\n", 0}
+					: run(fd, command);
+	}
+
+	Parcel done;
+	done.put(result.m_Status).put(result.m_Output).put(result.m_Errors).put(result.m_PeakRss);
+	done.put(outputs.size());
+	for (const auto& output : outputs) {
+		auto contents = output.empty() ? std::nullopt : Kitchen::Sink::read_file(scratch / output);
+		done.put(output).put(contents.has_value()).put(contents.value_or(std::string()));
+	}
+	bool sent = done.send(fd);
+	fs::current_path(store, ec);
+	fs::remove_all(scratch, ec);
+	return sent ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0] << " <socket> [store]\n";
+		return 2;
+	}
+	std::string socket = argv[1];
+	fs::path store = fs::absolute(argc > 2 ? argv[2] : ".flavortown-worker");
+	fs::create_directories(store / "blobs");
+	fs::create_directories(store / "jobs");
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socket.size() >= sizeof(address.sun_path)) {
+		std::cerr << "socket path too long: " << socket << "\n";
+		return 2;
+	}
+	std::memcpy(address.sun_path, socket.c_str(), socket.size() + 1);
+	::unlink(socket.c_str());
+	int listener = Kitchen::Sink::open_socket();
+	if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+		|| ::listen(listener, 64) != 0) {
+		std::cerr << "could not listen on " << socket << ": " << std::strerror(errno) << "\n";
+		return 1;
+	}
+	Kitchen::Sink::log(Kitchen::Sink::LogLevel::INFO, "worker listening on " + socket + ", store " + store.string());
+
+	::signal(SIGCHLD, SIG_IGN);
+	while (true) {
+		int fd = Kitchen::Sink::accept_socket(listener);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			std::cerr << "accept failed: " << std::strerror(errno) << "\n";
+			return 1;
+		}
+		pid_t pid = ::fork();
+		if (pid == 0) {
+			::signal(SIGCHLD, SIG_DFL);
+			::close(listener);
+			::_exit(serve(fd, store));
+		}
+		::close(fd);
+	}
+}